@@ -0,0 +1,128 @@
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+
+
+Logger& Logger::instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : _slots(new Slot[capacity])
+    , _head(0)
+    , _tail(0)
+    , _written(0)
+    , _level(Level::Info)
+    , _stop(false)
+{
+    for (std::size_t i = 0; i < capacity; ++i)
+    {
+        _slots[i]._sequence.store(i, std::memory_order_relaxed);
+    }
+    _writer = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger()
+{
+    _stop.store(true, std::memory_order_release);
+    _writer.join();
+}
+
+// Bounded MPMC queue (D. Vyukov) used here with a single consumer: a slot whose sequence equals
+// the claimed position is free, position + 1 means it holds a message. A full ring makes the
+// producer wait for the writer; no message is ever lost.
+void Logger::write(Level level, std::string message)
+{
+    std::size_t pos = _head.load(std::memory_order_relaxed);
+    Slot* slot = nullptr;
+    while (true)
+    {
+        slot = &_slots[pos & (capacity - 1)];
+        const std::size_t sequence = slot->_sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0)
+        {
+            if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+        }
+        else if (diff < 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            pos = _head.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            pos = _head.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->_level = level;
+    slot->_message = std::move(message);
+    slot->_sequence.store(pos + 1, std::memory_order_release);
+}
+
+void Logger::flush()
+{
+    const std::size_t target = _head.load(std::memory_order_acquire);
+    while (_written.load(std::memory_order_acquire) < target)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void Logger::run()
+{
+    static const std::size_t batch_size = 1 << 16;
+
+    std::string batch;
+    batch.reserve(batch_size);
+    std::chrono::milliseconds idle(1);
+
+    while (true)
+    {
+        const bool is_stopping = _stop.load(std::memory_order_acquire);
+
+        std::size_t taken = 0;
+        while (batch.size() < batch_size)
+        {
+            Slot& slot = _slots[_tail & (capacity - 1)];
+            if (slot._sequence.load(std::memory_order_acquire) != _tail + 1) { break; }
+
+            if (slot._level == Level::Error) { batch += "error: "; }
+            else if (slot._level == Level::Warning) { batch += "warning: "; }
+            batch += slot._message;
+            batch += '\n';
+            slot._message.clear();
+
+            slot._sequence.store(_tail + capacity, std::memory_order_release);
+            ++_tail;
+            ++taken;
+        }
+
+        if (!batch.empty())
+        {
+            std::fwrite(batch.data(), 1, batch.size(), stdout);
+            std::fflush(stdout);
+            batch.clear();
+        }
+        _written.fetch_add(taken, std::memory_order_release);
+
+        if (taken != 0)
+        {
+            idle = std::chrono::milliseconds(1);
+        }
+        else if (is_stopping)
+        {
+            return;
+        }
+        else
+        {
+            std::this_thread::sleep_for(idle);
+            idle = std::min(idle * 2, std::chrono::milliseconds(50));
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+
+
+enum class Level {
+    Error,
+    Warning,
+    Info,
+    Debug
+};
+
+// Leveled logger with a background writer. Producers put messages into a bounded lock-free
+// ring and do not wait for the terminal unless the ring is full; then they wait for room.
+// The writer thread drains the ring into stdout in large batches.
+class Logger {
+public:
+    static Logger& instance();
+
+    ~Logger();
+
+    void setLevel(Level level) { _level.store(level, std::memory_order_relaxed); }
+
+    bool enabled(Level level) const { return level <= _level.load(std::memory_order_relaxed); }
+
+    void write(Level level, std::string message);
+
+    // Blocks until every message written before the call has reached stdout.
+    void flush();
+
+private:
+    struct Slot {
+        std::atomic<std::size_t> _sequence;
+        Level _level;
+        std::string _message;
+    };
+
+    static const std::size_t capacity = 4096;   // power of two
+
+    Logger();
+
+    void run();
+
+    std::unique_ptr<Slot[]> _slots;
+    std::atomic<std::size_t> _head;           // next slot to be claimed by a producer
+    std::size_t _tail;                        // next slot to be read, writer thread only
+    std::atomic<std::size_t> _written;        // messages taken out of the ring so far
+    std::atomic<Level> _level;
+    std::atomic<bool> _stop;
+    std::thread _writer;
+};
+
+template<typename... Args>
+void logMessage(Level level, const Args&... args)
+{
+    Logger& logger = Logger::instance();
+    if (!logger.enabled(level)) { return; }
+
+    std::ostringstream out;
+    (void)std::initializer_list<int>{ ((out << args), 0)... };
+    logger.write(level, out.str());
+}
+
+template<typename... Args>
+void logError(const Args&... args) { logMessage(Level::Error, args...); }
+
+template<typename... Args>
+void logWarning(const Args&... args) { logMessage(Level::Warning, args...); }
+
+template<typename... Args>
+void logInfo(const Args&... args) { logMessage(Level::Info, args...); }
+
+template<typename... Args>
+void logDebug(const Args&... args) { logMessage(Level::Debug, args...); }
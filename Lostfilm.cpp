@@ -1,151 +1,63 @@
-#include <chrono>
-#include <codecvt>
-#include <fstream>
-#include <functional>
-#include <list>
-#include <iostream>
-#include <memory>
-#include <vector>
-#include <regex>
-#include <set>
-#include <string>
-#include <tuple>
-
-#include <boost/asio.hpp>
+#include "Lostfilm.h"
 
-#ifdef _MSC_VER
-  std::locale locr("rus_rus.1251");       // ukr_ukr.1251
-#else
-  std::locale locr("ru_RU");              // uk_UA
-#endif  // !_MSC_VER
-
-
-
-struct Information;
-
-struct Serial;
+#include <cerrno>
+#include <cstring>
 
-template<typename Str1, typename Str2>
-std::vector<Information> downloadInformation(Str1 host, Str2 path);
-
-template<typename Str>
-std::vector<Serial> downloadSerials(Str host, std::vector<Information> data);
-
-template<typename Str>
-void makeXmlGenres(Str filename, const std::set<std::string>& genres, bool is_to_utf8=false);
-
-template<typename Str>
-void makeXmlCountries(Str filename, const std::set<std::string>& countries, bool is_to_utf8=false);
-
-template<typename Str>
-void makeXmlFullData(Str filename, const std::vector<Serial>& serials, bool is_to_utf8=false);
-
-std::set<std::string> reorganizeGenres(const std::vector<Serial>& disorganized);
+#ifdef _WIN32
+  #include <direct.h>                     // _mkdir
+#else
+  #include <sys/stat.h>                   // mkdir
+#endif  // _WIN32
 
-std::set<std::string> reorganizeCountries(std::vector<Serial>& disorganized);
 
 
-int main()
+std::locale russianLocale()
 {
-    std::locale::global(locr);
-
-    std::string host = "www.lostfilm.tv";
-    std::string path = "/serials.php";
-    
-
-    auto data = downloadInformation(host, path);
-    std::cout << data.size() << " elements\n";
-    
-    auto serials = downloadSerials(host, std::move(data));
-    
-    auto genres = reorganizeGenres(serials);
-    makeXmlGenres("genres.xml", genres);
-
-    auto countries = reorganizeCountries(serials);
-    makeXmlCountries("countries.xml", countries);
-
-    makeXmlFullData("tvseries.xml", serials);
-
-    std::copy(serials.begin(), serials.end(), std::ostream_iterator<Serial>(std::cout, "\n"));
-
-    return 0;
+#ifdef _MSC_VER
+    return std::locale("rus_rus.1251");       // ukr_ukr.1251
+#else
+    for (const char* name : { "ru_RU.CP1251", "ru_RU" })    // uk_UA
+    {
+        try { return std::locale(name); }
+        catch (const std::runtime_error&) {}
+    }
+    logWarning("no ru_RU locale is installed, falling back to the classic one");
+    return std::locale::classic();
+#endif  // !_MSC_VER
 }
 
+std::locale locr = russianLocale();
 
+std::string record_dir;
+std::string replay_dir;
 
-struct Information {
-    std::string _path;
-    std::string _loc_name;
-    std::string _orig_name;
-
-    Information(std::string url, std::string loc_name, std::string orig_name)
-        : _path(std::move(url))
-        , _loc_name(std::move(loc_name))
-        , _orig_name(std::move(orig_name))
-    {}
-};
-
-struct Serial {
-    std::string _path;
-    std::string _loc_name;
-    std::string _orig_name;
-    std::string _country;
-    std::string _release_year;
-    std::string _genre;
-    std::string _seasons_amount;
-    std::string _status;
-
-public:
-    Serial(const std::string& path,
-        const std::string& loc_name,
-        const std::string& orig_name,
-        const std::string& country,
-        const std::string& release_year,
-        const std::string& genre,
-        const std::string& seasons_amount,
-        const std::string& status)
-        : _path(std::move(path))
-        , _loc_name(std::move(loc_name))
-        , _orig_name(std::move(orig_name))
-        , _country(std::move(country))
-        , _release_year(std::move(release_year))
-        , _genre(std::move(genre))
-        , _seasons_amount(std::move(seasons_amount))
-        , _status(std::move(status))
-    {}
-
-    friend std::ostream& operator<<(std::ostream& out, const Serial& serial)
-    {
-        out << "\nPath:           " << serial._path
-            << "\nLocale name:    " << serial._loc_name
-            << "\nOriginal name:  " << serial._orig_name
-            << "\nCountry:        " << serial._country
-            << "\nRelease year:   " << serial._release_year
-            << "\nGenre:          " << serial._genre
-            << "\nSeasons amount: " << serial._seasons_amount
-            << "\nStatus:         " << serial._status;
-        return out;
-    }
-};
+OriginPool origins;
+std::size_t connections = 1;
 
 
 
 std::string& trim(std::string& str)
 {
-    if (!str.empty())
-    {
-        std::size_t pos = 0;
-        while (std::isspace(*(str.begin() + pos), locr)) { ++pos; }
-        if (pos != 0) { str.erase(0, pos); }
+    std::size_t pos = 0;
+    while (pos < str.size() && std::isspace(str[pos], locr)) { ++pos; }
+    if (pos != 0) { str.erase(0, pos); }
 
-        std::size_t rpos = 0;
-        while (std::isspace(*(str.rbegin() + rpos), locr)) { ++rpos; }
-        if (rpos != 0) { str.erase(str.size() - rpos, str.size()); }
-    }
+    std::size_t rpos = 0;
+    while (rpos < str.size() && std::isspace(str[str.size() - 1 - rpos], locr)) { ++rpos; }
+    if (rpos != 0) { str.erase(str.size() - rpos); }
     return str;
 }
 
-std::vector<std::string> tokenize(std::string str, const char* seps, const bool is_to_upeer = false)
+// windows-1251 by table, so capitalizing Cyrillic does not depend on the locale found at run time.
+char toUpperCp1251(const char ch)
+{
+    const auto c = static_cast<unsigned char>(ch);
+    if ((c >= 'a' && c <= 'z') || c >= 0xE0) { return static_cast<char>(c - 0x20); }
+    if (c == 0xB8) { return '\xA8'; }                           // yo
+    return ch;
+}
+
+std::vector<std::string> tokenize(std::string str, const char* seps, const bool is_to_upeer)
 {
     std::vector<std::string> vs;
 
@@ -159,40 +71,97 @@ std::vector<std::string> tokenize(std::string str, const char* seps, const bool
     while (std::getline(ss, tmp))
     {
         tmp = trim(tmp);
-        if (is_to_upeer)    // is to uppercase the first letter
+        if (is_to_upeer && !tmp.empty())    // is to uppercase the first letter
         {
-            std::use_facet<std::ctype<char>>(locr).toupper(&tmp[0], &tmp[0] + 1);
+            tmp[0] = toUpperCp1251(tmp[0]);
         }
         vs.emplace_back(std::move(tmp));
     }
     return vs;
 }
 
+// Table driven, so the UTF-8 outputs do not depend on a windows-1251 locale being installed.
 std::string cp1251ToUtf8(const std::string& str)
 {
-    std::wstring wstr(str.length(), 0);
-    std::use_facet<std::ctype<wchar_t>>(std::locale(locr)).widen(&str[0], &str[0] + str.length(), &wstr[0]);
-    const std::string ustr = std::wstring_convert<std::codecvt_utf8<wchar_t>, wchar_t>().to_bytes(wstr);
+    static const char16_t upper_half[128] = {
+        0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+        0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0xFFFD, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+        0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+        0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+        0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+        0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+        0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+        0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+        0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+        0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+        0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+        0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+        0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+        0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+    };
+
+    std::string ustr;
+    ustr.reserve(str.size() * 2);
+    for (const auto ch : str)
+    {
+        const auto c = static_cast<unsigned char>(ch);
+        if (c < 0x80) { ustr += ch; continue; }
+
+        const char16_t code = upper_half[c - 0x80];
+        if (code < 0x800)
+        {
+            ustr += static_cast<char>(0xC0 | (code >> 6));
+        }
+        else
+        {
+            ustr += static_cast<char>(0xE0 | (code >> 12));
+            ustr += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        }
+        ustr += static_cast<char>(0x80 | (code & 0x3F));
+    }
     return ustr;
 };
 
-std::string converter(const std::string& data, bool is_to_utf8 = false)
+std::string converter(const std::string& data, bool is_to_utf8)
 {
     if (is_to_utf8) { return cp1251ToUtf8(data); }
     else { return data; }
 }
 
+// "/browse.php?cat=272" -> "<dir>/_browse_php_cat_272.html"
+std::string pagePath(const std::string& dir, const std::string& path)
+{
+    std::string name = path;
+    std::replace_if(name.begin(), name.end(), [](const char c) { return !std::isalnum(c, std::locale::classic()); }, '_');
+    return dir + "/" + name + ".html";
+}
 
+void makeDirectory(const std::string& dir)
+{
+#ifdef _WIN32
+    const int result = _mkdir(dir.data());
+#else
+    const int result = mkdir(dir.data(), 0777);
+#endif  // _WIN32
+    if (result != 0 && errno != EEXIST)
+    {
+        throw std::runtime_error("Cannot create " + dir + ": " + std::strerror(errno));
+    }
+}
 
-template<typename Str1, typename Str2>
-std::stringstream downloadPage(Str1 host, Str2 path)
+// Connects to address:port but asks for the page of `host`, so mirrors and proxies get the
+// same request as the site itself. Anything but a 2xx answer is an error.
+void fetchPage(const std::string& address, const std::string& port,
+    const std::string& host, const std::string& path, std::stringstream& page)
 {
     boost::asio::ip::tcp::iostream ios;
-    ios.expires_from_now(boost::posix_time::seconds(5));
-    ios.connect(host, "http");
+    ios.expires_after(std::chrono::seconds(5));
+    ios.connect(address, port);
     if (!ios)
     {
-        throw std::exception(ios.error().message().data());
+        throw std::runtime_error(ios.error().message());
     }
 
     ios << "GET " << path << " HTTP/1.0\r\n";
@@ -200,225 +169,536 @@ std::stringstream downloadPage(Str1 host, Str2 path)
     ios << "Accept: */*\r\n";
     ios << "Connection: close\r\n\r\n";
 
+    std::string status;
+    std::getline(ios, status);
+    const auto code = status.find(' ');
+    if (!ios || code == std::string::npos || status.compare(code + 1, 1, "2") != 0)
+    {
+        throw std::runtime_error("Bad response from " + address + ":" + port + ": " + trim(status));
+    }
+
     std::string header;
     while (std::getline(ios, header) && header != "\r") {}
 
-    std::stringstream page;
     page << ios.rdbuf();
-    return page;
 }
 
-template<typename Str1, typename Str2>
-std::vector<Information> downloadInformation(Str1 host, Str2 path)
+
+
+std::string xmlDeclaration(bool is_to_utf8)
 {
-    std::stringstream ss = downloadPage(host, path);
+    static const std::string charset_cp1251 = "windows-1251";
+    static const std::string charset_utf8 = "utf-8";
+
+    std::string head;
+    head += "<?xml version=\"1.0\" encoding=\"";
+    if (is_to_utf8) { head += charset_utf8; }
+    else { head += charset_cp1251; }
+    head += "\"?>\n\n";
+
+    return head;
+}
 
-    std::string buf;
-    std::string start_marker = "<!-- ###    -->";
-    while (std::getline(ss, buf) && (buf.find(start_marker) == std::string::npos))
+TrigramIndex makeTitleIndex(const std::vector<Serial>& serials)
+{
+    TrigramIndex index;
+    for (const auto& e : serials)
     {
+        index.add(e._path, e._loc_name, e._orig_name);
     }
+    return index;
+}
 
-    std::vector<Information> data;
+std::string xmlUnescape(std::string str)
+{
+    static const std::pair<std::string, std::string> entities[] = {
+        { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" }
+    };
+    for (const auto& e : entities)
+    {
+        for (auto pos = str.find(e.first); pos != std::string::npos; pos = str.find(e.first, pos + 1))
+        {
+            str.replace(pos, e.first.size(), e.second);
+        }
+    }
+    return str;
+}
 
-    std::string end_marker = "<br />";
-    while (std::getline(ss, buf) && (buf.find(end_marker) == std::string::npos))
+// Reads the titles back from a tvseries.xml written by XmlFullDataSink, in either encoding.
+TrigramIndex indexXmlFullData(const std::string& filename)
+{
+    static const std::regex expr_tvs(R"_(<tvs name="(.*)" locname="(.*)" year=)_");
+    static const std::regex expr_path(R"_(path="(.*)"/>)_");
+
+    TrigramIndex index;
+    std::ifstream fin(filename);
+    bool is_utf8 = false;
+    std::string orig_name;
+    std::string loc_name;
+    std::string line;
+    while (std::getline(fin, line))
     {
         std::smatch match;
-        std::regex expr(R"_(<a href="(.*)" class="bb_a">(.*)<br><span>\((.*)\)</span></a>)_");
-        if (std::regex_search(buf, match, expr))
+        if (line.find("<?xml") != std::string::npos)
+        {
+            is_utf8 = line.find("utf-8") != std::string::npos || line.find("UTF-8") != std::string::npos;
+        }
+        else if (std::regex_search(line, match, expr_tvs))
+        {
+            orig_name = xmlUnescape(match[1]);
+            loc_name = xmlUnescape(match[2]);
+            if (is_utf8)
+            {
+                orig_name = utf8ToCp1251(orig_name);
+                loc_name = utf8ToCp1251(loc_name);
+            }
+        }
+        else if (std::regex_search(line, match, expr_path))
         {
-            data.emplace_back(std::move(match[1]), std::move(match[2]), std::move(match[3]));
+            index.add(match[1], std::move(loc_name), std::move(orig_name));
         }
     }
-    return data;
+    return index;
 }
 
-template<typename Str>
-std::vector<Serial> downloadSerials(Str host, std::vector<Information> data)
+
+
+Catalog makeCatalog(const std::vector<Serial>& serials)
 {
-    std::vector<Serial> serials;
-    std::size_t index = 0;
+    Catalog catalog;
+    catalog._records.reserve(serials.size());
+    for (const auto& e : serials)
+    {
+        catalog._records.push_back({ &e, tokenize(e._genre, ",./", true), tokenize(e._country, ",./", true) });
+        catalog._genres.insert(catalog._records.back()._genres.begin(), catalog._records.back()._genres.end());
+        catalog._countries.insert(catalog._records.back()._countries.begin(), catalog._records.back()._countries.end());
+    }
+    return catalog;
+}
 
-    std::regex expr_country(R"_(: (.+)<br />)_");
-    std::regex expr_releaseyear(R"_( : <span>(.+)</span><br />)_");
-    std::regex expr_genre(R"_(: <span>(.+)</span><br />)_");
-    std::regex expr_seasons_amount(R"_( : <span>(.+)</span><br />)_");
-    std::regex expr_status(R"_(: (.+)<br />)_");
+void XmlGenresSink::write(std::ostream& fout, const Catalog& catalog) const
+{
+    fout << xmlDeclaration(_is_to_utf8);
+    fout << "<genres>";
+    fout << "\n";
 
-    for (const auto& e : data)
+    for (const auto& e : catalog._genres)
     {
-        std::cout << "<" << index++ << "> Receiving information about " << e._loc_name << ".\n";
+        fout << "  <genre>";
+        fout << converter(e, _is_to_utf8);
+        fout << "</genre>\n";
+    }
 
-        const std::stringstream ss = downloadPage(host, e._path);
+    fout << "</genres>";
+    fout << "\n";
+}
 
-        const std::string page = ss.str();
+void XmlCountriesSink::write(std::ostream& fout, const Catalog& catalog) const
+{
+    fout << xmlDeclaration(_is_to_utf8);
+    fout << "<countries>";
+    fout << "\n";
 
-        const std::string start_marker = "<h1>" + e._loc_name + " " + "(" + e._orig_name + ")" + "</h1><br />";
-        static const std::string end_marker = R"_(<div class="content">)_";
+    for (const auto& e : catalog._countries)
+    {
+        fout << "  <country>";
+        fout << converter(e, _is_to_utf8);
+        fout << "</country>\n";
+    }
 
-        const auto start_pos = page.find(start_marker);
-        const auto end_pos = page.find(end_marker, start_pos);
+    fout << "</countries>";
+    fout << "\n";
+}
 
-        const std::string block(page.begin() + start_pos, page.begin() + end_pos);
+void XmlFullDataSink::write(std::ostream& fout, const Catalog& catalog) const
+{
+    fout << xmlDeclaration(_is_to_utf8);
+    fout << "<tvseries>\n";
+    for (const auto& r : catalog._records)
+    {
+        const Serial& e = *r._serial;
+        fout << "  <tvs name=\"";
+        fout << converter(e._orig_name, _is_to_utf8);
+        fout << "\" locname=\"";
+        fout << converter(e._loc_name, _is_to_utf8);
+        fout << "\" year=\"";
+        fout << e._release_year;
+        fout << "\">\n";
+        fout << "    <info amount=\"";
+        fout << e._seasons_amount;
+        fout << "\" status=\"";
+        fout << converter(e._status, _is_to_utf8);
+        fout << "\" path=\"" << e._path;
+        fout << "\"/>\n";
+
+        fout << "    <genres>\n";
+        for (const auto& genre : r._genres)
+        {
+            fout << "      <genre>";
+            fout << converter(genre, _is_to_utf8);
+            fout << "</genre>\n";
+        }
+        fout << "    </genres>\n";
 
-        // lambda
-        static const auto _search = [](const std::string& s, const std::regex& r) -> std::string {
-            std::smatch m;
-            if (std::regex_search(s, m, r))
-            {
-                return m[1];
-            }
-            return{ "" };
-        };
-
-        serials.emplace_back(
-            std::move(e._path),
-            std::move(e._loc_name),
-            std::move(e._orig_name),
-            _search(block, expr_country),
-            _search(block, expr_releaseyear),
-            _search(block, expr_genre),
-            _search(block, expr_seasons_amount),
-            _search(block, expr_status)
-        );
+        fout << "    <countries>\n";
+        for (const auto& country : r._countries)
+        {
+            fout << "      <country>";
+            fout << converter(country, _is_to_utf8);
+            fout << "</country>\n";
+        }
+        fout << "    </countries>\n";
+        fout << "  </tvs>\n";
     }
-    return serials;
+    fout << "</tvseries>\n";
+}
+
+std::string jsonString(const std::string& str)
+{
+    std::string json = "\"";
+    for (const auto c : cp1251ToUtf8(str))
+    {
+        if (c == '"' || c == '\\') { json += '\\'; json += c; }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+            json += escaped;
+        }
+        else { json += c; }
+    }
+    json += '"';
+    return json;
 }
 
+std::string jsonArray(const std::vector<std::string>& strs)
+{
+    std::string json = "[";
+    for (const auto& e : strs)
+    {
+        if (json.size() > 1) { json += ','; }
+        json += jsonString(e);
+    }
+    json += ']';
+    return json;
+}
 
+void JsonLinesSink::write(std::ostream& fout, const Catalog& catalog) const
+{
+    for (const auto& r : catalog._records)
+    {
+        const Serial& e = *r._serial;
+        fout << "{\"path\":" << jsonString(e._path)
+            << ",\"name\":" << jsonString(e._orig_name)
+            << ",\"locname\":" << jsonString(e._loc_name)
+            << ",\"year\":" << jsonString(e._release_year)
+            << ",\"amount\":" << jsonString(e._seasons_amount)
+            << ",\"status\":" << jsonString(e._status)
+            << ",\"genres\":" << jsonArray(r._genres)
+            << ",\"countries\":" << jsonArray(r._countries)
+            << "}\n";
+    }
+}
 
-std::string xmlDeclaration(bool is_to_utf8=false)
+std::string csvField(const std::string& str)
 {
-    static const std::string charset_cp1251 = "windows-1251";
-    static const std::string charset_utf8 = "utf-8";
+    if (str.find_first_of(",\"\r\n") == std::string::npos) { return str; }
 
-    std::string head;
-    head += "<?xml version=\"1.0\" encoding=\"";
-    if (is_to_utf8) { head += charset_utf8; }
-    else { head += charset_cp1251; }
-    head += "\"?>\n\n";
+    std::string csv = "\"";
+    for (const auto c : str)
+    {
+        if (c == '"') { csv += '"'; }
+        csv += c;
+    }
+    csv += '"';
+    return csv;
+}
 
-    return head;
+std::string csvList(const std::vector<std::string>& strs)
+{
+    std::string list;
+    for (const auto& e : strs)
+    {
+        if (!list.empty()) { list += "; "; }
+        list += e;
+    }
+    return list;
 }
 
-template<typename Str>
-void makeXmlGenres(Str filename, const std::set<std::string>& genres, bool is_to_utf8)
+void CsvSink::write(std::ostream& fout, const Catalog& catalog) const
 {
-    std::ofstream fout(filename);
-    if (fout.is_open())
+    fout << "path,name,locname,year,amount,status,genres,countries\r\n";
+    for (const auto& r : catalog._records)
     {
-        fout << xmlDeclaration(is_to_utf8);
-        fout << "<genres>";
-        fout << "\n";
+        const Serial& e = *r._serial;
+        fout << csvField(e._path)
+            << "," << csvField(converter(e._orig_name, _is_to_utf8))
+            << "," << csvField(converter(e._loc_name, _is_to_utf8))
+            << "," << csvField(e._release_year)
+            << "," << csvField(e._seasons_amount)
+            << "," << csvField(converter(e._status, _is_to_utf8))
+            << "," << csvField(converter(csvList(r._genres), _is_to_utf8))
+            << "," << csvField(converter(csvList(r._countries), _is_to_utf8))
+            << "\r\n";
+    }
+}
 
-        for (const auto& e : genres) 
+std::vector<std::unique_ptr<Sink>> makeSinks(const std::string& formats, const std::string& prefix, bool is_to_utf8)
+{
+    std::vector<std::unique_ptr<Sink>> sinks;
+    std::set<std::string> seen;
+    for (const auto& format : tokenize(formats, ","))
+    {
+        // two sinks of one format would write and rename the same temporary file at once
+        if (!seen.insert(format).second) { throw std::runtime_error("Duplicate output format: " + format); }
+
+        if (format == "xml")
         {
-            fout << "  <genre>";
-            if (is_to_utf8) { fout << cp1251ToUtf8(e); }
-            else { fout << e; }
-            fout << "</genre>\n";
+            sinks.emplace_back(new XmlGenresSink(prefix + "genres.xml", is_to_utf8));
+            sinks.emplace_back(new XmlCountriesSink(prefix + "countries.xml", is_to_utf8));
+            sinks.emplace_back(new XmlFullDataSink(prefix + "tvseries.xml", is_to_utf8));
         }
+        else if (format == "jsonl") { sinks.emplace_back(new JsonLinesSink(prefix + "tvseries.jsonl")); }
+        else if (format == "csv") { sinks.emplace_back(new CsvSink(prefix + "tvseries.csv", is_to_utf8)); }
+        else { throw std::runtime_error("Unknown output format: " + format); }
+    }
+    if (sinks.empty()) { throw std::runtime_error("No output format in \"" + formats + "\""); }
+    return sinks;
+}
 
-        fout << "</genres>";
-        fout << "\n";
+void writeSinks(const Catalog& catalog, const std::vector<std::unique_ptr<Sink>>& sinks)
+{
+    std::vector<std::future<void>> writers;
+    for (const auto& sink : sinks)
+    {
+        writers.push_back(std::async(std::launch::async, [&catalog, &sink]() {
+            writeAtomically(sink->filename(), [&](std::ostream& fout) { sink->write(fout, catalog); });
+        }));
+    }
+    for (auto& e : writers)
+    {
+        e.get();
     }
 }
 
-template<typename Str>
-void makeXmlCountries(Str filename, const std::set<std::string>& countries, bool is_to_utf8)
+
+
+// "/browse.php?cat=272" -> "272"; the whole path when there is no cat parameter
+std::string catId(const std::string& path)
 {
-    std::ofstream fout(filename);
-    if (fout.is_open())
+    static const std::regex expr(R"_(cat=(\d+))_");
+    std::smatch match;
+    if (std::regex_search(path, match, expr))
     {
-        fout << xmlDeclaration(is_to_utf8);
-        fout << "<countries>";
-        fout << "\n";
+        return match[1];
+    }
+    return path;
+}
 
-        for (const auto& e : countries)
+// FNV-1a, stable between runs and platforms so it can be kept in the state file
+unsigned long long hashInformation(const Information& info)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (const auto& str : { info._path, info._loc_name, info._orig_name })
+    {
+        for (const auto c : str)
         {
-            fout << "  <country>";
-            if (is_to_utf8) { fout << cp1251ToUtf8(e); }
-            else { fout << e; }
-            fout << "</country>\n";
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
         }
+        hash ^= 0xff;                     // field separator
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
 
-        fout << "</countries>";
-        fout << "\n";
+// Serial fields are kept tab separated, one serial per line.
+std::string escapeField(const std::string& str)
+{
+    std::string escaped;
+    for (const auto c : str)
+    {
+        if (c == '\\') { escaped += "\\\\"; }
+        else if (c == '\t') { escaped += "\\t"; }
+        else if (c == '\n') { escaped += "\\n"; }
+        else if (c == '\r') { escaped += "\\r"; }
+        else { escaped += c; }
     }
+    return escaped;
 }
 
-template<typename Str>
-void makeXmlFullData(Str filename, const std::vector<Serial>& serials, bool is_to_utf8)
+std::string unescapeField(const std::string& str)
 {
-    std::ofstream fout(filename);
-    if (fout.is_open())
+    std::string unescaped;
+    for (std::size_t i = 0; i < str.size(); ++i)
+    {
+        if (str[i] != '\\' || i + 1 == str.size()) { unescaped += str[i]; continue; }
+        const char c = str[++i];
+        unescaped += c == 't' ? '\t' : c == 'n' ? '\n' : c == 'r' ? '\r' : c;
+    }
+    return unescaped;
+}
+
+// Details of the series fetched so far, so a restarted daemon does not fetch the whole catalog again.
+std::map<std::string, Serial> loadSerials(const std::string& filename)
+{
+    std::map<std::string, Serial> serials;
+    std::ifstream fin(filename);
+    std::string line;
+    while (std::getline(fin, line))
+    {
+        std::vector<std::string> fields;
+        std::size_t begin = 0;
+        for (auto end = line.find('\t'); ; end = line.find('\t', begin))
+        {
+            fields.push_back(unescapeField(line.substr(begin, end == std::string::npos ? end : end - begin)));
+            if (end == std::string::npos) { break; }
+            begin = end + 1;
+        }
+        if (fields.size() != 8) { continue; }
+
+        const std::string id = catId(fields[0]);
+        serials.erase(id);
+        serials.emplace(id, Serial(fields[0], fields[1], fields[2], fields[3], fields[4], fields[5], fields[6], fields[7]));
+    }
+    return serials;
+}
+
+void saveSerials(const std::string& filename, const std::map<std::string, Serial>& serials)
+{
+    writeAtomically(filename, [&](std::ostream& fout)
     {
-        fout << xmlDeclaration(is_to_utf8);
-        fout << "<tvseries>\n";
         for (const auto& e : serials)
         {
-            fout << "  <tvs name=\"";
-            fout << converter(e._orig_name, is_to_utf8);
-            fout << "\" locname=\"";
-            fout << converter(e._loc_name, is_to_utf8);
-            fout << "\" year=\"";
-            fout << e._release_year;
-            fout << "\">\n";
-            fout << "    <info amount=\"";
-            fout << e._seasons_amount;
-            fout << "\" status=\"";
-            fout << converter(e._status, is_to_utf8);
-            fout << "\" path=\"" << e._path;
-            fout << "\"/>\n";
-
-            fout << "    <genres>\n";
-            for (const auto genres : tokenize(e._genre, ",./", true))
-            {
-                fout << "      <genre>";
-                fout << converter(genres, is_to_utf8);
-                fout << "</genre>\n";
-            }
-            fout << "    </genres>\n";
+            const Serial& s = e.second;
+            fout << escapeField(s._path)
+                << "\t" << escapeField(s._loc_name)
+                << "\t" << escapeField(s._orig_name)
+                << "\t" << escapeField(s._country)
+                << "\t" << escapeField(s._release_year)
+                << "\t" << escapeField(s._genre)
+                << "\t" << escapeField(s._seasons_amount)
+                << "\t" << escapeField(s._status)
+                << "\n";
+        }
+    });
+}
 
-            fout << "    <countries>\n";
-            for (const auto countries : tokenize(e._country, ",./", true))
-            {
-                fout << "      <country>";
-                fout << converter(countries, is_to_utf8);
-                fout << "</country>\n";
-            }
-            fout << "    </countries>\n";
-            fout << "  </tvs>\n";
+std::map<std::string, unsigned long long> loadListingState(const std::string& filename)
+{
+    std::map<std::string, unsigned long long> hashes;
+    std::ifstream fin(filename);
+    std::string id;
+    unsigned long long hash;
+    while (fin >> id >> hash)
+    {
+        hashes[id] = hash;
+    }
+    return hashes;
+}
+
+void saveListingState(const std::string& filename, const std::map<std::string, unsigned long long>& hashes)
+{
+    writeAtomically(filename, [&](std::ostream& fout)
+    {
+        for (const auto& e : hashes)
+        {
+            fout << e.first << "\t" << e.second << "\n";
         }
-        fout << "</tvseries>\n";
+    });
+}
+
+bool loadStale(const std::string& filename, const std::vector<std::unique_ptr<Sink>>& sinks)
+{
+    int is_stale = 1;
+    std::ifstream(filename) >> is_stale;
+    for (const auto& e : sinks)
+    {
+        is_stale = is_stale || !std::ifstream(e->filename()).is_open();
     }
+    return is_stale || !std::ifstream("tvseries.idx").is_open();
 }
 
+void saveStale(const std::string& filename, bool is_stale)
+{
+    writeAtomically(filename, [is_stale](std::ostream& fout) { fout << (is_stale ? 1 : 0) << "\n"; });
+}
 
+void appendChangeFeed(const std::string& filename, const std::vector<ChangeRecord>& changes)
+{
+    static const char* names[] = { "added", "removed", "changed" };
 
-enum class Member {
-    Genre,
-    Country
-};
+    std::ofstream fout(filename, std::ios::out | std::ios::app);
+    if (fout.is_open())
+    {
+        char stamp[32];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        for (const auto& e : changes)
+        {
+            fout << stamp
+                << "\t" << names[static_cast<int>(e._change)]
+                << "\t" << e._path
+                << "\t" << e._loc_name
+                << "\t" << e._orig_name
+                << "\n";
+        }
+    }
+}
+
+// The base interval follows the status; series whose details changed on most of the previous
+// fetches are refreshed up to four times as often.
+std::chrono::seconds refreshInterval(const std::string& status, const Schedule& schedule)
+{
+    static const std::chrono::hours ongoing(24);
+    static const std::chrono::hours finished(24 * 30);
+    static const std::chrono::hours unknown(24 * 7);
+
+    std::chrono::seconds base = unknown;
+    if (status.find("") != std::string::npos) { base = ongoing; }
+    else if (status.find("") != std::string::npos) { base = finished; }
+
+    if (schedule._fetches == 0) { return base; }
+    return base * schedule._fetches / (schedule._fetches + 3 * schedule._changes);
+}
 
-std::set<std::string> reorganize(const std::vector<Serial>& disorganized, Member mem)
+std::map<std::string, Schedule> loadSchedules(const std::string& filename)
 {
-    std::set<std::string> organized;
-    for (const auto& e : disorganized)
+    std::map<std::string, Schedule> schedules;
+    std::ifstream fin(filename);
+    std::string id;
+    Schedule schedule;
+    while (fin >> id >> schedule._last_fetch >> schedule._fetches >> schedule._changes)
     {
-        const auto v = tokenize(mem == Member::Genre ? e._genre : e._country, ".,/", true);
-        organized.insert(v.begin(), v.end());
+        schedules[id] = schedule;
     }
-    return organized;
+    return schedules;
+}
+
+void saveSchedules(const std::string& filename, const std::map<std::string, Schedule>& schedules)
+{
+    writeAtomically(filename, [&](std::ostream& fout)
+    {
+        for (const auto& e : schedules)
+        {
+            fout << e.first
+                << "\t" << e.second._last_fetch
+                << "\t" << e.second._fetches
+                << "\t" << e.second._changes
+                << "\n";
+        }
+    });
 }
 
-std::set<std::string> reorganizeGenres(const std::vector<Serial>& disorganized)
+bool sameDetails(const Serial& lhs, const Serial& rhs)
 {
-    return reorganize(disorganized, Member::Genre);
+    return std::tie(lhs._country, lhs._release_year, lhs._genre, lhs._seasons_amount, lhs._status)
+        == std::tie(rhs._country, rhs._release_year, rhs._genre, rhs._seasons_amount, rhs._status);
 }
 
-std::set<std::string> reorganizeCountries(std::vector<Serial>& disorganized)
+bool sameSerial(const Serial& lhs, const Serial& rhs)
 {
-    return reorganize(disorganized, Member::Country);
+    return std::tie(lhs._path, lhs._loc_name, lhs._orig_name) == std::tie(rhs._path, rhs._loc_name, rhs._orig_name)
+        && sameDetails(lhs, rhs);
 }
@@ -0,0 +1,751 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <codecvt>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <list>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include <boost/asio.hpp>
+
+#include "Logger.h"
+#include "OriginPool.h"
+#include "TrigramIndex.h"
+
+
+
+extern std::locale locr;
+
+// When set, downloadPage saves every page it receives into record_dir (--record, which the command
+// line runs as a full crawl apart from the state files, so the corpus is complete)
+// or serves pages from replay_dir instead of the network (--replay).
+extern std::string record_dir;
+extern std::string replay_dir;
+
+// When not empty, pages are requested from these origins instead of the host itself (--origin),
+// by up to `connections` requests at a time (--connections).
+extern OriginPool origins;
+extern std::size_t connections;
+
+
+
+struct Information;
+
+struct Serial;
+
+template<typename Str1, typename Str2>
+std::vector<Information> downloadInformation(Str1 host, Str2 path);
+
+// With `is_partial` a page that fails is logged and left out of the result; otherwise the first
+// failure is rethrown once the workers have stopped.
+template<typename Str>
+std::vector<Serial> downloadSerials(Str host, std::vector<Information> data, bool is_partial = false);
+
+struct Catalog;
+
+class Sink;
+
+Catalog makeCatalog(const std::vector<Serial>& serials);
+
+// formats: comma separated list of "xml", "jsonl" and "csv"
+std::vector<std::unique_ptr<Sink>> makeSinks(const std::string& formats, const std::string& prefix = "", bool is_to_utf8 = false);
+
+void writeSinks(const Catalog& catalog, const std::vector<std::unique_ptr<Sink>>& sinks);
+
+template<typename Str1, typename Str2>
+void runDaemon(Str1 host, Str2 path, std::chrono::seconds interval, std::size_t budget,
+    const std::vector<std::unique_ptr<Sink>>& sinks);
+
+
+
+struct Information {
+    std::string _path;
+    std::string _loc_name;
+    std::string _orig_name;
+
+    Information(std::string url, std::string loc_name, std::string orig_name)
+        : _path(std::move(url))
+        , _loc_name(std::move(loc_name))
+        , _orig_name(std::move(orig_name))
+    {}
+};
+
+struct Serial {
+    std::string _path;
+    std::string _loc_name;
+    std::string _orig_name;
+    std::string _country;
+    std::string _release_year;
+    std::string _genre;
+    std::string _seasons_amount;
+    std::string _status;
+
+public:
+    Serial(const std::string& path,
+        const std::string& loc_name,
+        const std::string& orig_name,
+        const std::string& country,
+        const std::string& release_year,
+        const std::string& genre,
+        const std::string& seasons_amount,
+        const std::string& status)
+        : _path(std::move(path))
+        , _loc_name(std::move(loc_name))
+        , _orig_name(std::move(orig_name))
+        , _country(std::move(country))
+        , _release_year(std::move(release_year))
+        , _genre(std::move(genre))
+        , _seasons_amount(std::move(seasons_amount))
+        , _status(std::move(status))
+    {}
+
+    friend std::ostream& operator<<(std::ostream& out, const Serial& serial)
+    {
+        out << "\nPath:           " << serial._path
+            << "\nLocale name:    " << serial._loc_name
+            << "\nOriginal name:  " << serial._orig_name
+            << "\nCountry:        " << serial._country
+            << "\nRelease year:   " << serial._release_year
+            << "\nGenre:          " << serial._genre
+            << "\nSeasons amount: " << serial._seasons_amount
+            << "\nStatus:         " << serial._status;
+        return out;
+    }
+};
+
+
+
+enum class Change {
+    Added,
+    Removed,
+    Changed
+};
+
+struct ChangeRecord {
+    Change _change;
+    std::string _path;
+    std::string _loc_name;
+    std::string _orig_name;
+
+    ChangeRecord(Change change, std::string path, std::string loc_name, std::string orig_name)
+        : _change(change)
+        , _path(std::move(path))
+        , _loc_name(std::move(loc_name))
+        , _orig_name(std::move(orig_name))
+    {}
+};
+
+struct Schedule {
+    std::time_t _last_fetch = 0;
+    unsigned _fetches = 0;
+    unsigned _changes = 0;
+};
+
+
+
+std::string& trim(std::string& str);
+
+std::vector<std::string> tokenize(std::string str, const char* seps, const bool is_to_upeer = false);
+
+std::string cp1251ToUtf8(const std::string& str);
+
+std::string converter(const std::string& data, bool is_to_utf8 = false);
+
+std::string pagePath(const std::string& dir, const std::string& path);
+
+// Creates one directory level unless it exists already; throws on failure.
+void makeDirectory(const std::string& dir);
+
+void fetchPage(const std::string& address, const std::string& port,
+    const std::string& host, const std::string& path, std::stringstream& page);
+
+std::string xmlDeclaration(bool is_to_utf8 = false);
+
+TrigramIndex makeTitleIndex(const std::vector<Serial>& serials);
+
+TrigramIndex indexXmlFullData(const std::string& filename);
+
+std::string catId(const std::string& path);
+
+unsigned long long hashInformation(const Information& info);
+
+std::map<std::string, unsigned long long> loadListingState(const std::string& filename);
+
+void saveListingState(const std::string& filename, const std::map<std::string, unsigned long long>& hashes);
+
+std::map<std::string, Serial> loadSerials(const std::string& filename);
+
+void saveSerials(const std::string& filename, const std::map<std::string, Serial>& serials);
+
+// Whether the outputs lag behind serials.state: a rewrite is pending per the state file, there is
+// no state file yet, or one of the outputs is missing.
+bool loadStale(const std::string& filename, const std::vector<std::unique_ptr<Sink>>& sinks);
+
+void saveStale(const std::string& filename, bool is_stale);
+
+void appendChangeFeed(const std::string& filename, const std::vector<ChangeRecord>& changes);
+
+std::chrono::seconds refreshInterval(const std::string& status, const Schedule& schedule);
+
+std::map<std::string, Schedule> loadSchedules(const std::string& filename);
+
+void saveSchedules(const std::string& filename, const std::map<std::string, Schedule>& schedules);
+
+// Country, year, genre, amount of seasons and status; what the refresh schedule adapts to.
+bool sameDetails(const Serial& lhs, const Serial& rhs);
+
+// Every field, names and path included; what the outputs show.
+bool sameSerial(const Serial& lhs, const Serial& rhs);
+
+
+
+template<typename Str1, typename Str2>
+std::stringstream downloadPage(Str1 host, Str2 path)
+{
+    std::stringstream page;
+    if (!replay_dir.empty())
+    {
+        std::ifstream fin(pagePath(replay_dir, path), std::ios::binary);
+        if (!fin.is_open())
+        {
+            throw std::runtime_error("No recorded page for " + std::string(path));
+        }
+        page << fin.rdbuf();
+        return page;
+    }
+
+    if (origins.empty())
+    {
+        fetchPage(host, "http", host, path, page);
+    }
+    else
+    {
+        // a failed request is retried on an origin it has not been sent to yet
+        std::vector<std::size_t> tried;
+        while (true)
+        {
+            const std::size_t origin = origins.acquire(tried);
+            tried.push_back(origin);
+            const auto start = std::chrono::steady_clock::now();
+            const auto elapsed = [&start]() {
+                return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            };
+            try
+            {
+                fetchPage(origins.address(origin), origins.port(origin), host, path, page);
+                origins.release(origin, true, elapsed());
+                break;
+            }
+            catch (const std::exception& e)
+            {
+                origins.release(origin, false, elapsed());
+                if (tried.size() >= origins.size()) { throw; }
+                logWarning(origins.address(origin), ":", origins.port(origin), " ", path, ": ", e.what());
+                page.str("");
+                page.clear();
+            }
+        }
+    }
+
+    if (!record_dir.empty())
+    {
+        const std::string filename = pagePath(record_dir, path);
+        std::ofstream fout(filename, std::ios::binary);
+        fout << page.str();
+        if (!fout.flush())
+        {
+            throw std::runtime_error("Cannot record " + filename);
+        }
+    }
+    return page;
+}
+
+template<typename Str1, typename Str2>
+std::vector<Information> downloadInformation(Str1 host, Str2 path)
+{
+    std::stringstream ss = downloadPage(host, path);
+
+    std::string buf;
+    std::string start_marker = "<!-- ###    -->";
+    while (std::getline(ss, buf) && (buf.find(start_marker) == std::string::npos))
+    {
+    }
+
+    std::vector<Information> data;
+
+    std::string end_marker = "<br />";
+    while (std::getline(ss, buf) && (buf.find(end_marker) == std::string::npos))
+    {
+        std::smatch match;
+        std::regex expr(R"_(<a href="(.*)" class="bb_a">(.*)<br><span>\((.*)\)</span></a>)_");
+        if (std::regex_search(buf, match, expr))
+        {
+            data.emplace_back(std::move(match[1]), std::move(match[2]), std::move(match[3]));
+        }
+    }
+    return data;
+}
+
+template<typename Str>
+std::vector<Serial> downloadSerials(Str host, std::vector<Information> data, bool is_partial)
+{
+    std::vector<std::unique_ptr<Serial>> received(data.size());
+    std::atomic<std::size_t> next(0);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    std::regex expr_country(R"_(: (.+)<br />)_");
+    std::regex expr_releaseyear(R"_( : <span>(.+)</span><br />)_");
+    std::regex expr_genre(R"_(: <span>(.+)</span><br />)_");
+    std::regex expr_seasons_amount(R"_( : <span>(.+)</span><br />)_");
+    std::regex expr_status(R"_(: (.+)<br />)_");
+
+    // lambda
+    static const auto _search = [](const std::string& s, const std::regex& r) -> std::string {
+        std::smatch m;
+        if (std::regex_search(s, m, r))
+        {
+            return m[1];
+        }
+        return{ "" };
+    };
+
+    const auto fail = [&](std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) { error = e; }
+        next = data.size();
+    };
+
+    // every worker takes the next unfetched page until none is left or one of them has failed
+    const auto worker = [&]() {
+        for (std::size_t index = next++; index < data.size(); index = next++)
+        {
+            const auto& e = data[index];
+            try
+            {
+                logInfo("<", index, "> Receiving information about ", e._loc_name, ".");
+
+                const std::stringstream ss = downloadPage(host, e._path);
+
+                const std::string page = ss.str();
+
+                const std::string start_marker = "<h1>" + e._loc_name + " " + "(" + e._orig_name + ")" + "</h1><br />";
+                static const std::string end_marker = R"_(<div class="content">)_";
+
+                const auto start_pos = page.find(start_marker);
+                const auto end_pos = page.find(end_marker, start_pos);
+                if (start_pos == std::string::npos || end_pos == std::string::npos)
+                {
+                    throw std::runtime_error("No details in the page");
+                }
+
+                const std::string block(page.begin() + start_pos, page.begin() + end_pos);
+
+                received[index].reset(new Serial(
+                    std::move(e._path),
+                    std::move(e._loc_name),
+                    std::move(e._orig_name),
+                    _search(block, expr_country),
+                    _search(block, expr_releaseyear),
+                    _search(block, expr_genre),
+                    _search(block, expr_seasons_amount),
+                    _search(block, expr_status)
+                ));
+            }
+            catch (const std::exception& ex)
+            {
+                if (!is_partial) { fail(std::current_exception()); }
+                else { logError(e._path, ": ", ex.what()); }
+            }
+            catch (...)
+            {
+                fail(std::current_exception());
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (std::size_t i = 1; i < std::min(connections, data.size()); ++i)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& e : workers)
+    {
+        e.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    std::vector<Serial> serials;
+    serials.reserve(data.size());
+    for (auto& e : received)
+    {
+        if (e) { serials.push_back(std::move(*e)); }
+    }
+    return serials;
+}
+
+
+
+// Writes into "<filename>.tmp" and renames it over the target, so readers never see a half-written file.
+// Throws when the file cannot be written or put in place; the old file is left untouched then.
+template<typename Str>
+void writeAtomically(Str filename, const std::function<void(std::ostream&)>& write, bool is_binary = false)
+{
+    const std::string target(filename);
+    const std::string temp = target + ".tmp";
+    {
+        std::vector<char> buffer(1 << 20);
+        std::ofstream fout;
+        fout.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        fout.open(temp, is_binary ? std::ios::out | std::ios::trunc | std::ios::binary : std::ios::out | std::ios::trunc);
+        if (!fout.is_open())
+        {
+            throw std::runtime_error("Cannot create " + temp);
+        }
+        try
+        {
+            write(fout);
+            if (!fout.flush())
+            {
+                throw std::runtime_error("Cannot write " + temp);
+            }
+        }
+        catch (...)
+        {
+            fout.close();
+            std::remove(temp.data());
+            throw;
+        }
+    }
+#ifdef _MSC_VER
+    std::remove(target.data());           // rename does not replace an existing file here
+#endif  // _MSC_VER
+    if (std::rename(temp.data(), target.data()) != 0)
+    {
+        std::remove(temp.data());
+        throw std::runtime_error("Cannot replace " + target);
+    }
+}
+
+// Genres and countries of every serial are split once here and shared by all the sinks.
+struct Record {
+    const Serial* _serial;
+    std::vector<std::string> _genres;
+    std::vector<std::string> _countries;
+};
+
+struct Catalog {
+    std::vector<Record> _records;
+    std::set<std::string> _genres;
+    std::set<std::string> _countries;
+};
+
+// An output format. Every sink writes its own file; writeSinks runs them in parallel.
+class Sink {
+public:
+    explicit Sink(std::string filename, bool is_to_utf8 = false)
+        : _filename(std::move(filename))
+        , _is_to_utf8(is_to_utf8)
+    {}
+
+    virtual ~Sink() {}
+
+    const std::string& filename() const { return _filename; }
+
+    virtual void write(std::ostream& fout, const Catalog& catalog) const = 0;
+
+protected:
+    std::string _filename;
+    bool _is_to_utf8;
+};
+
+class XmlGenresSink : public Sink {
+public:
+    using Sink::Sink;
+    void write(std::ostream& fout, const Catalog& catalog) const override;
+};
+
+class XmlCountriesSink : public Sink {
+public:
+    using Sink::Sink;
+    void write(std::ostream& fout, const Catalog& catalog) const override;
+};
+
+class XmlFullDataSink : public Sink {
+public:
+    using Sink::Sink;
+    void write(std::ostream& fout, const Catalog& catalog) const override;
+};
+
+// One JSON object per line, always UTF-8.
+class JsonLinesSink : public Sink {
+public:
+    using Sink::Sink;
+    void write(std::ostream& fout, const Catalog& catalog) const override;
+};
+
+// RFC 4180, genres and countries joined with "; ".
+class CsvSink : public Sink {
+public:
+    using Sink::Sink;
+    void write(std::ostream& fout, const Catalog& catalog) const override;
+};
+
+
+
+// One polling cycle: diff the listing against the previous one and fetch the detail pages that
+// are due, at most `budget` of them (0 means no limit). Series without details come first, the
+// rest in order of how overdue they are; a listing change makes a series due immediately.
+// The outputs are rewritten only once every listed series has details, so a budget never
+// publishes a partial catalog; `is_stale` carries the pending rewrite over to the next cycle.
+// A page that fails does not fail the cycle: the series stays due, and one that has no details
+// yet waits behind the others and is left out of the outputs while its page keeps failing.
+// changes.log follows the listing as it is seen, so with a budget an added series is in the feed
+// a few cycles before the outputs show it.
+// Returns the published serials, empty when the outputs were left as they are.
+template<typename Str1, typename Str2>
+std::vector<Serial> refreshListing(Str1 host, Str2 path,
+    std::map<std::string, unsigned long long>& hashes,
+    std::map<std::string, Schedule>& schedules,
+    std::map<std::string, Serial>& known,
+    std::size_t budget,
+    const std::vector<std::unique_ptr<Sink>>& sinks,
+    bool& is_stale)
+{
+    const auto data = downloadInformation(host, path);
+
+    // A maintenance page, a captcha or a broken mirror parses as an empty or a truncated listing;
+    // diffing it would report the catalog as removed, so the cycle fails before anything is written.
+    // A real cut of more than half the catalog has to be accepted by removing listing.state.
+    if (data.empty())
+    {
+        throw std::runtime_error("No series in the listing " + std::string(path));
+    }
+    if (data.size() * 2 < hashes.size())
+    {
+        throw std::runtime_error("The listing shrank from " + std::to_string(hashes.size())
+            + " to " + std::to_string(data.size()) + " series");
+    }
+
+    const std::time_t now = std::time(nullptr);
+
+    std::map<std::string, unsigned long long> current;
+    std::vector<Information> to_fetch;
+    std::vector<std::pair<std::time_t, const Information*>> missing;
+    std::vector<std::pair<double, const Information*>> due;
+    std::vector<ChangeRecord> changes;
+
+    for (const auto& e : data)
+    {
+        const std::string id = catId(e._path);
+        const auto hash = hashInformation(e);
+        current[id] = hash;
+
+        auto& schedule = schedules[id];
+        const auto it = hashes.find(id);
+        if (it == hashes.end())
+        {
+            changes.emplace_back(Change::Added, e._path, e._loc_name, e._orig_name);
+        }
+        else if (it->second != hash)
+        {
+            changes.emplace_back(Change::Changed, e._path, e._loc_name, e._orig_name);
+            schedule._last_fetch = 0;
+        }
+
+        const auto serial = known.find(id);
+        if (serial == known.end())
+        {
+            missing.emplace_back(schedule._last_fetch, &e);      // the last failed attempt, if any
+            continue;
+        }
+
+        const auto interval = refreshInterval(serial->second._status, schedule);
+        const double overdue = std::difftime(now, schedule._last_fetch) / interval.count();
+        if (overdue >= 1.0)
+        {
+            due.emplace_back(overdue, &e);
+        }
+    }
+
+    std::stable_sort(missing.begin(), missing.end(),
+        [](const std::pair<std::time_t, const Information*>& a, const std::pair<std::time_t, const Information*>& b) {
+            return a.first < b.first;
+        });
+    std::stable_sort(due.begin(), due.end(),
+        [](const std::pair<double, const Information*>& a, const std::pair<double, const Information*>& b) {
+            return a.first > b.first;
+        });
+    for (const auto& e : missing)
+    {
+        to_fetch.push_back(*e.second);
+    }
+    for (const auto& e : due)
+    {
+        to_fetch.push_back(*e.second);
+    }
+    if (budget != 0 && to_fetch.size() > budget)
+    {
+        to_fetch.erase(to_fetch.begin() + budget, to_fetch.end());
+    }
+
+    for (const auto& e : hashes)
+    {
+        if (current.find(e.first) == current.end())
+        {
+            const auto it = known.find(e.first);
+            if (it != known.end())
+            {
+                changes.emplace_back(Change::Removed, it->second._path, it->second._loc_name, it->second._orig_name);
+            }
+            else
+            {
+                changes.emplace_back(Change::Removed, e.first, "", "");
+            }
+        }
+    }
+
+    logInfo(data.size(), " elements, ", changes.size(), " changes, ",
+        due.size(), " due, ", to_fetch.size(), " pages to fetch");
+
+    std::set<std::string> failed;
+    for (const auto& e : to_fetch)
+    {
+        failed.insert(catId(e._path));
+    }
+    for (auto& e : downloadSerials(host, std::move(to_fetch), true))
+    {
+        const std::string id = catId(e._path);
+        auto& schedule = schedules[id];
+        failed.erase(id);
+
+        const auto it = known.find(id);
+        if (it != known.end())
+        {
+            if (!sameSerial(it->second, e))
+            {
+                is_stale = true;
+            }
+            if (!sameDetails(it->second, e))
+            {
+                ++schedule._changes;
+                const auto previous = hashes.find(id);
+                if (previous != hashes.end() && previous->second == current[id])
+                {
+                    changes.emplace_back(Change::Changed, e._path, e._loc_name, e._orig_name);
+                }
+            }
+            known.erase(it);
+        }
+        else
+        {
+            is_stale = true;
+        }
+        ++schedule._fetches;
+        schedule._last_fetch = now;
+        known.emplace(id, std::move(e));
+    }
+
+    for (const auto& id : failed)
+    {
+        if (known.find(id) == known.end()) { schedules[id]._last_fetch = now; }
+    }
+
+    for (const auto& e : hashes)
+    {
+        if (current.find(e.first) == current.end())
+        {
+            known.erase(e.first);
+            schedules.erase(e.first);
+        }
+    }
+
+    is_stale = is_stale || !changes.empty();
+
+    std::vector<Serial> serials;
+    serials.reserve(data.size());
+    std::size_t unavailable = 0;
+    for (const auto& e : data)
+    {
+        const std::string id = catId(e._path);
+        const auto it = known.find(id);
+        if (it != known.end()) { serials.push_back(it->second); }
+        else if (failed.count(id) != 0) { ++unavailable; }
+    }
+    if (serials.size() + unavailable != data.size())
+    {
+        logInfo(serials.size(), " of ", data.size(), " series have details, the outputs wait for the rest");
+        serials.clear();
+    }
+    else if (is_stale)
+    {
+        if (unavailable != 0)
+        {
+            logWarning(unavailable, " series are left out of the outputs, their pages failed");
+        }
+        writeSinks(makeCatalog(serials), sinks);
+        const auto index = makeTitleIndex(serials);
+        writeAtomically("tvseries.idx", [&index](std::ostream& fout) { index.save(fout); }, true);
+        is_stale = false;
+    }
+    else
+    {
+        serials.clear();
+    }
+
+    if (!changes.empty())
+    {
+        appendChangeFeed("changes.log", changes);
+    }
+    hashes = std::move(current);
+    saveListingState("listing.state", hashes);
+    saveSchedules("schedule.state", schedules);
+    saveSerials("serials.state", known);
+    saveStale("outputs.state", is_stale);
+    return serials;
+}
+
+template<typename Str1, typename Str2>
+void runDaemon(Str1 host, Str2 path, std::chrono::seconds interval, std::size_t budget,
+    const std::vector<std::unique_ptr<Sink>>& sinks)
+{
+    auto hashes = loadListingState("listing.state");
+    auto schedules = loadSchedules("schedule.state");
+    auto known = loadSerials("serials.state");
+    bool is_stale = loadStale("outputs.state", sinks);
+
+    while (true)
+    {
+        try
+        {
+            refreshListing(host, path, hashes, schedules, known, budget, sinks, is_stale);
+        }
+        catch (const std::exception& e)
+        {
+            logError(e.what());
+        }
+        std::this_thread::sleep_for(interval);
+    }
+}
@@ -0,0 +1,229 @@
+#include <random>
+
+#include "Lostfilm.h"
+
+
+
+// `lostfilm_bench --titles N`: builds a trigram index over N synthetic titles and times
+// fuzzy queries with a typo against it.
+int benchTitleIndex(std::size_t amount)
+{
+    static const std::string consonants = "bcdfghjklmnprstvwz";
+    static const std::string vowels = "aeiouy";
+    std::mt19937 random(42);
+    const auto word = [&random]() {
+        std::string w;
+        for (int i = 1 + random() % 3; i != 0; --i)
+        {
+            w += consonants[random() % consonants.size()];
+            w += vowels[random() % vowels.size()];
+            if (random() % 3 == 0) { w += consonants[random() % consonants.size()]; }
+        }
+        return w;
+    };
+
+    using clock = std::chrono::steady_clock;
+    std::vector<std::string> names;
+    TrigramIndex index;
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < amount; ++i)
+    {
+        std::string name = word() + " " + word();
+        index.add("/browse.php?cat=" + std::to_string(i), name, word() + " " + word());
+        names.push_back(std::move(name));
+    }
+    const auto built = clock::now();
+
+    const std::size_t queries = 1000;
+    std::size_t found = 0;
+    for (std::size_t i = 0; i < queries; ++i)
+    {
+        const std::size_t target = random() % amount;
+        std::string query = names[target];
+        query[random() % query.size()] = 'z';
+        const auto matches = index.search(query);
+        found += !matches.empty() && matches.front()._title == target;
+    }
+    const auto searched = clock::now();
+
+    std::cout << amount << " titles"
+        << "\n  build:  " << std::chrono::duration<double, std::milli>(built - start).count() << " ms"
+        << "\n  search: " << std::chrono::duration<double, std::micro>(searched - built).count() / queries
+        << " us per query, " << found << " of " << queries << " typos found first\n";
+    return 0;
+}
+
+// A stand-in mirror on 127.0.0.1 that serves a recorded corpus one request at a time, each after
+// `delay`, like an origin with a per-host rate limit. A broken one answers every request with 503.
+class StandInServer {
+public:
+    StandInServer(std::string corpus, std::chrono::milliseconds delay, bool is_broken)
+        : _corpus(std::move(corpus))
+        , _delay(delay)
+        , _is_broken(is_broken)
+        , _acceptor(_io, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+        , _stop(false)
+        , _thread(&StandInServer::run, this)
+    {}
+
+    ~StandInServer()
+    {
+        _stop = true;
+        boost::asio::ip::tcp::iostream wake("127.0.0.1", std::to_string(port()));
+        _thread.join();
+    }
+
+    unsigned short port() const { return _acceptor.local_endpoint().port(); }
+
+    std::string origin() const { return "127.0.0.1:" + std::to_string(port()); }
+
+private:
+    void run()
+    {
+        while (!_stop)
+        {
+            boost::asio::ip::tcp::socket socket(_io);
+            boost::system::error_code error;
+            _acceptor.accept(socket, error);
+            if (error || _stop) { continue; }
+
+            boost::asio::ip::tcp::iostream ios(std::move(socket));
+            std::string request;
+            std::getline(ios, request);
+            std::string header;
+            while (std::getline(ios, header) && header != "\r") {}
+
+            std::this_thread::sleep_for(_delay);
+
+            std::ifstream fin(pagePath(_corpus, request.substr(4, request.rfind(' ') - 4)), std::ios::binary);
+            if (_is_broken || !fin.is_open())
+            {
+                ios << "HTTP/1.0 503 Service Unavailable\r\n\r\n";
+                continue;
+            }
+            ios << "HTTP/1.0 200 OK\r\nConnection: close\r\n\r\n" << fin.rdbuf();
+        }
+    }
+
+    std::string _corpus;
+    std::chrono::milliseconds _delay;
+    bool _is_broken;
+    boost::asio::io_context _io;
+    boost::asio::ip::tcp::acceptor _acceptor;
+    std::atomic<bool> _stop;
+    std::thread _thread;
+};
+
+// `lostfilm_bench --mirrors <dir>`: crawls a recorded corpus through stand-in servers, first
+// from a single origin, then balanced over a fast, a slow and a broken one.
+int benchMirrors(const std::string& corpus)
+{
+    const StandInServer slow(corpus, std::chrono::milliseconds(20), false);
+    const StandInServer fast(corpus, std::chrono::milliseconds(5), false);
+    const StandInServer broken(corpus, std::chrono::milliseconds(0), true);
+
+    const std::string host = "www.lostfilm.tv";
+    const std::string path = "/serials.php";
+    connections = 8;
+
+    std::vector<std::size_t> before;
+    const auto crawl = [&](const char* title) {
+        before.resize(origins.size(), 0);
+        const auto start = std::chrono::steady_clock::now();
+        const auto serials = downloadSerials(host, downloadInformation(host, path));
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << title << ": " << serials.size() << " pages in " << elapsed.count() << " s, "
+            << (serials.size() + 1) / elapsed.count() << " pages/s\n";
+        for (std::size_t i = 0; i < origins.size(); ++i)
+        {
+            std::cout << "  " << origins.address(i) << ":" << origins.port(i) << " "
+                << origins.requests(i) - before[i] << " requests\n";
+            before[i] = origins.requests(i);
+        }
+    };
+
+    try
+    {
+        origins.add(slow.origin());
+        crawl("one origin (20 ms)");
+
+        // the broken one answers fastest, yet every retry has to land on the good one
+        origins.add(broken.origin());
+        crawl("two origins (20 ms, broken)");
+
+        origins.add(fast.origin());
+        crawl("three origins (20 ms, broken, 5 ms)");
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Replays a corpus recorded with `lostfilm --record <dir>` through the listing and detail page
+// parsers and all the output sinks. The PGO build is trained on this run.
+int main(int argc, char* argv[])
+{
+    std::locale::global(locr);
+    Logger::instance().setLevel(Level::Warning);
+
+    if (argc > 2 && std::string(argv[1]) == "--titles")
+    {
+        return benchTitleIndex(std::stoul(argv[2]));
+    }
+    if (argc > 2 && std::string(argv[1]) == "--mirrors")
+    {
+        return benchMirrors(argv[2]);
+    }
+
+    replay_dir = argc > 1 ? argv[1] : "corpus";
+    const int rounds = argc > 2 ? std::stoi(argv[2]) : 10;
+    const auto sinks = makeSinks("xml,jsonl,csv", "bench_");
+
+    const std::string host = "www.lostfilm.tv";
+    const std::string path = "/serials.php";
+
+    using clock = std::chrono::steady_clock;
+    clock::duration listing{};
+    clock::duration details{};
+    clock::duration output{};
+    std::size_t amount = 0;
+
+    try
+    {
+        for (int i = 0; i < rounds; ++i)
+        {
+            const auto start = clock::now();
+            auto data = downloadInformation(host, path);
+            const auto parsed = clock::now();
+            auto serials = downloadSerials(host, std::move(data));
+            const auto fetched = clock::now();
+
+            writeSinks(makeCatalog(serials), sinks);
+            const auto written = clock::now();
+
+            listing += parsed - start;
+            details += fetched - parsed;
+            output += written - fetched;
+            amount = serials.size();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+
+    const auto average = [rounds](clock::duration d) {
+        return std::chrono::duration<double, std::milli>(d).count() / rounds;
+    };
+    std::cout << amount << " serials, " << rounds << " rounds, average per round:"
+        << "\n  listing: " << average(listing) << " ms"
+        << "\n  details: " << average(details) << " ms"
+        << "\n  output:  " << average(output) << " ms\n";
+
+    return 0;
+}
@@ -0,0 +1,510 @@
+#include "Lostfilm.h"
+
+
+
+int failures = 0;
+
+#define CHECK(expr) \
+    do { if (!(expr)) { ++failures; std::cerr << __FILE__ << ":" << __LINE__ << ": " #expr "\n"; } } while (false)
+
+
+
+void testTokenize()
+{
+    std::string str = " \t drama \n";
+    CHECK(trim(str) == "drama");
+    str = "   ";
+    CHECK(trim(str).empty());
+    str = "";
+    CHECK(trim(str).empty());
+    str = std::string(64, ' ');                   // past the small string buffer
+    CHECK(trim(str).empty());
+    str = "x";
+    CHECK(trim(str) == "x");
+
+    const auto genres = tokenize("drama, comedy,thriller", ",");
+    CHECK(genres == std::vector<std::string>({ "drama", "comedy", "thriller" }));
+
+    // cyrillic and yo are capitalized whatever locale is installed
+    const auto upper = tokenize("\xE4\xF0\xE0\xEC\xE0 / \xB8\xEB\xEA\xE8 / comedy", "/", true);
+    CHECK(upper == std::vector<std::string>({ "\xC4\xF0\xE0\xEC\xE0", "\xA8\xEB\xEA\xE8", "Comedy" }));
+}
+
+void testStateKeys()
+{
+    CHECK(catId("/browse.php?cat=272") == "272");
+    CHECK(catId("/series/lost") == "/series/lost");
+
+    const Information info("/browse.php?cat=1", "ab", "c");
+    CHECK(hashInformation(info) == hashInformation(Information("/browse.php?cat=1", "ab", "c")));
+    CHECK(hashInformation(info) != hashInformation(Information("/browse.php?cat=1", "a", "bc")));
+    CHECK(hashInformation(info) != hashInformation(Information("/browse.php?cat=2", "ab", "c")));
+}
+
+// The state files come back as they were saved, whatever the fields contain.
+void testStateFiles()
+{
+    std::map<std::string, Serial> serials;
+    serials.emplace("1", Serial("/browse.php?cat=1", "tab\there", "new\nline", "back\\slash", "2001", "drama\r\n", "", "\\t"));
+    serials.emplace("/series/2", Serial("/series/2", "Serial 2", "Series 2", "USA", "2002", "comedy", "2", "\xE7\xE0\xEA\xEE\xED\xF7\xE5\xED"));
+    saveSerials("lostfilm_test.state", serials);
+    const auto loaded = loadSerials("lostfilm_test.state");
+    CHECK(loaded.size() == serials.size());
+    for (const auto& e : serials)
+    {
+        const auto it = loaded.find(e.first);
+        CHECK(it != loaded.end() && sameSerial(it->second, e.second));
+    }
+
+    const std::map<std::string, Schedule> schedules = { { "1", { 1700000000, 4, 1 } }, { "2", {} } };
+    saveSchedules("lostfilm_test.state", schedules);
+    const auto schedules_loaded = loadSchedules("lostfilm_test.state");
+    CHECK(schedules_loaded.size() == 2);
+    CHECK(schedules_loaded.at("1")._last_fetch == 1700000000 && schedules_loaded.at("1")._fetches == 4
+        && schedules_loaded.at("1")._changes == 1);
+    CHECK(schedules_loaded.at("2")._last_fetch == 0 && schedules_loaded.at("2")._fetches == 0);
+
+    const std::map<std::string, unsigned long long> hashes = { { "1", 14695981039346656037ull }, { "272", 0 } };
+    saveListingState("lostfilm_test.state", hashes);
+    CHECK(loadListingState("lostfilm_test.state") == hashes);
+
+    std::remove("lostfilm_test.state");
+    CHECK(loadSerials("lostfilm_test.state").empty());
+}
+
+void testSinkEscaping()
+{
+    const std::vector<Serial> serials = {
+        Serial("/browse.php?cat=1", "\xD1\xE5\xF0\xE8\xE0\xEB", "Say \"Hi\", \\ Bye",
+            "USA, UK", "2001", "drama, comedy", "2", "line\nbreak")
+    };
+    const auto catalog = makeCatalog(serials);
+
+    std::ostringstream json;
+    JsonLinesSink("unused.jsonl").write(json, catalog);
+    CHECK(json.str() == "{\"path\":\"/browse.php?cat=1\",\"name\":\"Say \\\"Hi\\\", \\\\ Bye\","
+        "\"locname\":\"\xD0\xA1\xD0\xB5\xD1\x80\xD0\xB8\xD0\xB0\xD0\xBB\",\"year\":\"2001\",\"amount\":\"2\","
+        "\"status\":\"line\\u000abreak\",\"genres\":[\"Drama\",\"Comedy\"],\"countries\":[\"USA\",\"UK\"]}\n");
+
+    std::ostringstream csv;
+    CsvSink("unused.csv").write(csv, catalog);
+    CHECK(csv.str() == "path,name,locname,year,amount,status,genres,countries\r\n"
+        "/browse.php?cat=1,\"Say \"\"Hi\"\", \\ Bye\",\xD1\xE5\xF0\xE8\xE0\xEB,2001,2,\"line\nbreak\",Drama; Comedy,USA; UK\r\n");
+}
+
+void testMakeSinks()
+{
+    CHECK(makeSinks("xml,jsonl,csv").size() == 5);
+
+    for (const auto formats : { "json", "xml,xml", "xml,csv,xml", "" })
+    {
+        bool is_thrown = false;
+        try { makeSinks(formats); } catch (const std::runtime_error&) { is_thrown = true; }
+        CHECK(is_thrown);
+    }
+}
+
+void testTitleIndex()
+{
+    TrigramIndex index;
+    index.add("/browse.php?cat=1", "\xCE\xF1\xF2\xE0\xF2\xFC\xF1\xFF \xE2 \xE6\xE8\xE2\xFB\xF5", "Lost");
+    index.add("/browse.php?cat=2", "\xC4\xEE\xEA\xF2\xEE\xF0 \xD5\xE0\xF3\xE7", "House M.D.");
+    index.add("/browse.php?cat=3", "\xD1\xE2\xE5\xF0\xF5\xFA\xE5\xF1\xF2\xE5\xF1\xF2\xE2\xE5\xED\xED\xEE\xE5", "Supernatural");
+
+    const auto typo = index.search("supernatrual");
+    CHECK(!typo.empty() && index.title(typo[0]._title)._path == "/browse.php?cat=3");
+
+    const auto utf8 = index.search("\xD0\xB4\xD0\xBE\xD0\xBA\xD1\x82\xD0\xBE\xD1\x80 \xD1\x85\xD0\xB0\xD1\x83\xD1\x81");
+    CHECK(!utf8.empty() && index.title(utf8[0]._title)._orig_name == "House M.D.");
+
+    CHECK(index.search("zzzzzz").empty());
+
+    writeAtomically("lostfilm_test.idx", [&index](std::ostream& out) { index.save(out); }, true);
+    TrigramIndex loaded;
+    CHECK(loaded.load("lostfilm_test.idx"));
+    CHECK(loaded.size() == index.size());
+    const auto again = loaded.search("supernatrual");
+    CHECK(again.size() == typo.size() && !again.empty() && again[0]._title == typo[0]._title
+        && again[0]._score == typo[0]._score);
+
+    // a length past the end of the file fails the load instead of allocating it
+    writeAtomically("lostfilm_test.idx", [](std::ostream& out) { out << "LFTI0001\xFF\xFF\xFF\x7F"; }, true);
+    CHECK(!loaded.load("lostfilm_test.idx"));
+    std::string truncated;
+    writeAtomically("lostfilm_test.idx", [&index](std::ostream& out) { index.save(out); }, true);
+    {
+        std::ifstream in("lostfilm_test.idx", std::ios::binary);
+        truncated.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    truncated.resize(truncated.size() - 5);
+    writeAtomically("lostfilm_test.idx", [&truncated](std::ostream& out) { out << truncated; }, true);
+    CHECK(!loaded.load("lostfilm_test.idx"));
+    CHECK(loaded.size() == index.size());
+    std::remove("lostfilm_test.idx");
+}
+
+void testOriginEjection()
+{
+    OriginPool pool(std::chrono::milliseconds(100), 2, std::chrono::seconds(60));
+    pool.add("broken");
+    pool.add("good:8080");
+    CHECK(pool.port(0) == "http" && pool.port(1) == "8080");
+
+    for (int i = 0; i < 2; ++i)
+    {
+        pool.release(pool.acquire(), false, std::chrono::milliseconds(1));
+        pool.release(pool.acquire(), true, std::chrono::milliseconds(10));
+    }
+    for (int i = 0; i < 4; ++i)
+    {
+        const auto origin = pool.acquire();
+        CHECK(origin == 1);
+        pool.release(origin, true, std::chrono::milliseconds(10));
+    }
+
+    // too slow on average is ejected as well; with nothing left in rotation all origins are used
+    pool.release(pool.acquire(), true, std::chrono::milliseconds(500));
+    const auto first = pool.acquire();
+    const auto second = pool.acquire();
+    CHECK(first != second);
+}
+
+void testOriginRetry()
+{
+    OriginPool pool;
+    pool.add("good");
+    pool.add("broken");
+
+    const auto first = pool.acquire();
+    const auto second = pool.acquire();
+    CHECK(first != second);
+    pool.release(0, true, std::chrono::milliseconds(50));
+    pool.release(1, true, std::chrono::milliseconds(60));
+
+    // a fast failure does not count as low latency
+    const std::vector<std::size_t> tried = { pool.acquire() };
+    CHECK(tried[0] == 0);
+    pool.release(tried[0], true, std::chrono::milliseconds(50));
+    pool.release(pool.acquire({ 0 }), false, std::chrono::milliseconds(1));
+    CHECK(pool.acquire() == 0);
+    pool.release(0, true, std::chrono::milliseconds(50));
+
+    // a retry skips the origin that just failed, though it is the better one otherwise
+    CHECK(pool.acquire(tried) == 1);
+    pool.release(1, true, std::chrono::milliseconds(60));
+
+    // with every origin tried the pool still answers
+    const auto any = pool.acquire({ 0, 1 });
+    CHECK(any < pool.size());
+    pool.release(any, true, std::chrono::milliseconds(50));
+}
+
+// refreshListing runs against a small site replayed from the working directory.
+const char* const test_host = "www.lostfilm.tv";
+const char* const test_listing = "/serials.php";
+const char* const test_ongoing = "\xF1\xED\xE8\xEC\xE0\xE5\xF2\xF1\xFF";
+const char* const test_finished = "\xE7\xE0\xEA\xEE\xED\xF7\xE5\xED";
+
+void writeTestPage(const std::string& path, const std::string& content)
+{
+    std::ofstream(pagePath(replay_dir, path), std::ios::binary) << content;
+}
+
+void writeTestListing(const std::vector<Information>& data)
+{
+    std::string page = "<html>\n<!-- ### \xCF\xEE\xEB\xED\xFB\xE9 \xF1\xEF\xE8\xF1\xEE\xEA \xF1\xE5\xF0\xE8\xE0\xEB\xEE\xE2 -->\n";
+    for (const auto& e : data)
+    {
+        page += "<a href=\"" + e._path + "\" class=\"bb_a\">" + e._loc_name + "<br><span>(" + e._orig_name + ")</span></a>\n";
+    }
+    writeTestPage(test_listing, page + "<br />\n</html>\n");
+}
+
+void writeTestDetails(const Information& info, const std::string& status = test_ongoing)
+{
+    writeTestPage(info._path, "<html>\n<h1>" + info._loc_name + " (" + info._orig_name + ")</h1><br />\n"
+        "\xD1\xF2\xF0\xE0\xED\xE0: USA<br />\n"
+        "\xC3\xEE\xE4 \xE2\xFB\xF5\xEE\xE4\xE0: <span>2001</span><br />\n"
+        "\xC6\xE0\xED\xF0: <span>drama</span><br />\n"
+        "\xCA\xEE\xEB\xE8\xF7\xE5\xF1\xF2\xE2\xEE \xF1\xE5\xE7\xEE\xED\xEE\xE2: <span>1</span><br />\n"
+        "\xD1\xF2\xE0\xF2\xF3\xF1: " + status + "<br />\n"
+        "<div class=\"content\">\n</html>\n");
+}
+
+std::string readTestFile(const std::string& filename)
+{
+    std::ifstream fin(filename, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(fin), std::istreambuf_iterator<char>());
+}
+
+const char* const test_files[] = {
+    "listing.state", "schedule.state", "serials.state", "changes.log",
+    "outputs.state", "genres.xml", "countries.xml", "tvseries.xml", "tvseries.idx"
+};
+
+const std::vector<std::unique_ptr<Sink>>& testSinks()
+{
+    static const auto sinks = makeSinks("xml");
+    return sinks;
+}
+
+// The state refreshListing keeps between cycles, loaded and saved like the daemon does it.
+struct TestCrawler {
+    std::map<std::string, unsigned long long> _hashes = loadListingState("listing.state");
+    std::map<std::string, Schedule> _schedules = loadSchedules("schedule.state");
+    std::map<std::string, Serial> _known = loadSerials("serials.state");
+    bool _is_stale = loadStale("outputs.state", testSinks());
+
+    std::vector<Serial> refresh(std::size_t budget = 0)
+    {
+        return refreshListing(test_host, test_listing, _hashes, _schedules, _known, budget, testSinks(), _is_stale);
+    }
+};
+
+std::vector<Information> startTestSite(std::size_t amount)
+{
+    for (const auto e : test_files) { std::remove(e); }
+
+    std::vector<Information> data;
+    for (std::size_t i = 1; i <= amount; ++i)
+    {
+        const auto n = std::to_string(i);
+        data.emplace_back("/browse.php?cat=" + n, "Serial " + n, "Series " + n);
+        writeTestDetails(data.back());
+    }
+    writeTestListing(data);
+    return data;
+}
+
+void removeTestSite(const std::vector<Information>& data)
+{
+    for (const auto e : test_files) { std::remove(e); }
+    for (const auto& e : data) { std::remove(pagePath(replay_dir, e._path).data()); }
+    std::remove(pagePath(replay_dir, test_listing).data());
+}
+
+void testBrokenListing()
+{
+    const auto data = startTestSite(4);
+    TestCrawler().refresh();
+
+    std::vector<std::string> before;
+    for (const auto e : test_files) { before.push_back(readTestFile(e)); }
+
+    // a maintenance page, then a listing that lost most of the catalog
+    writeTestPage(test_listing, "<html>maintenance</html>");
+    bool is_thrown = false;
+    try { TestCrawler().refresh(); } catch (const std::runtime_error&) { is_thrown = true; }
+    CHECK(is_thrown);
+
+    writeTestListing({ data[0] });
+    is_thrown = false;
+    try { TestCrawler().refresh(); } catch (const std::runtime_error&) { is_thrown = true; }
+    CHECK(is_thrown);
+
+    for (std::size_t i = 0; i < before.size(); ++i)
+    {
+        CHECK(readTestFile(test_files[i]) == before[i]);
+    }
+    removeTestSite(data);
+}
+
+std::size_t countFeed(const std::string& kind, const std::string& path = "")
+{
+    std::size_t count = 0;
+    std::ifstream fin("changes.log");
+    std::string line;
+    while (std::getline(fin, line))
+    {
+        const bool is_kind = line.find("\t" + kind + "\t") != std::string::npos;
+        if (is_kind && line.find("\t" + path) != std::string::npos) { ++count; }
+    }
+    return count;
+}
+
+void testRefreshInterval()
+{
+    using hours = std::chrono::hours;
+    CHECK(refreshInterval(test_ongoing, {}) == hours(24));
+    CHECK(refreshInterval(test_finished, {}) == hours(24 * 30));
+    CHECK(refreshInterval("", {}) == hours(24 * 7));
+
+    Schedule schedule;
+    schedule._fetches = 4;
+    CHECK(refreshInterval(test_ongoing, schedule) == hours(24));
+    schedule._changes = 4;                        // changed on every fetch: four times as often
+    CHECK(refreshInterval(test_ongoing, schedule) == hours(6));
+    schedule._changes = 1;
+    CHECK(refreshInterval(test_ongoing, schedule) == std::chrono::seconds(24 * 3600 * 4 / 7));
+}
+
+// Listing deltas and detail changes end up in changes.log once each.
+void testChangeFeed()
+{
+    auto data = startTestSite(4);
+    TestCrawler crawler;
+    crawler.refresh();
+    CHECK(countFeed("added") == 4);
+
+    data[0]._loc_name += " (renamed)";
+    writeTestDetails(data[0]);
+    const auto removed = data[1];
+    data.erase(data.begin() + 1);
+    data.emplace_back("/browse.php?cat=5", "Serial 5", "Series 5");
+    writeTestDetails(data.back());
+    writeTestListing(data);
+    crawler.refresh();
+    CHECK(countFeed("added") == 5 && countFeed("added", "/browse.php?cat=5") == 1);
+    CHECK(countFeed("removed") == 1 && countFeed("removed", "/browse.php?cat=2") == 1);
+    CHECK(countFeed("changed") == 1 && countFeed("changed", "/browse.php?cat=1") == 1);
+    CHECK(crawler._known.count("2") == 0 && crawler._schedules.count("2") == 0);
+    CHECK(crawler._known.at("1")._loc_name == "Serial 1 (renamed)");
+
+    // a detail change the listing does not show is found when the series is due again
+    writeTestDetails(data[1], test_finished);
+    crawler._schedules.at("3")._last_fetch = 0;
+    crawler.refresh();
+    CHECK(countFeed("changed") == 2 && countFeed("changed", "/browse.php?cat=3") == 1);
+    CHECK(crawler._schedules.at("3")._changes == 1);
+    CHECK(readTestFile("tvseries.xml").find(test_finished) != std::string::npos);
+
+    crawler.refresh();
+    CHECK(countFeed("changed") == 2 && countFeed("added") == 5 && countFeed("removed") == 1);
+    removeTestSite(data);
+    std::remove(pagePath(replay_dir, removed._path).data());
+}
+
+// A budget smaller than the work fetches the missing series first, then the most overdue, and
+// publishes nothing until every listed series has details.
+void testBudget()
+{
+    const auto data = startTestSite(5);
+    TestCrawler crawler;
+    CHECK(crawler.refresh(2).empty());
+    CHECK(crawler._known.size() == 2 && crawler._known.count("1") == 1 && crawler._known.count("2") == 1);
+    CHECK(readTestFile("tvseries.xml").empty());
+    CHECK(crawler.refresh(2).empty());
+    CHECK(crawler._known.size() == 4);
+    CHECK(readTestFile("tvseries.xml").empty());
+    CHECK(countFeed("added") == 5);
+
+    // the last missing series goes before series 1 and 3, which are due as well
+    const std::time_t now = std::time(nullptr);
+    crawler._schedules.at("1")._last_fetch = now - 2 * 24 * 3600;
+    crawler._schedules.at("3")._last_fetch = now - 3 * 24 * 3600;
+    CHECK(crawler.refresh(2).size() == 5);
+    CHECK(crawler._schedules.at("5")._fetches == 1);
+    CHECK(crawler._schedules.at("3")._fetches == 2 && crawler._schedules.at("1")._fetches == 1);
+    CHECK(readTestFile("tvseries.xml").find("Series 5") != std::string::npos);
+
+    CHECK(crawler.refresh(2).empty());            // series 1 fetched, nothing changed
+    CHECK(crawler._schedules.at("1")._fetches == 2 && crawler._schedules.at("2")._fetches == 1);
+    removeTestSite(data);
+}
+
+// Renamed series refetched one per cycle still reach the outputs once they are all fetched.
+void testRenamedSeries()
+{
+    auto data = startTestSite(3);
+    TestCrawler crawler;
+    crawler.refresh();
+
+    for (const std::size_t i : { 1, 2 })
+    {
+        data[i]._orig_name += " Renamed";
+        writeTestDetails(data[i]);
+    }
+    writeTestListing(data);
+    for (int cycle = 0; cycle < 3; ++cycle)
+    {
+        crawler.refresh(1);
+    }
+
+    const auto xml = readTestFile("tvseries.xml");
+    CHECK(xml.find("Series 2 Renamed") != std::string::npos && xml.find("Series 3 Renamed") != std::string::npos);
+    CHECK(xml.find("\"Series 3\"") == std::string::npos);
+    CHECK(crawler._known.at("3")._orig_name == "Series 3 Renamed");
+    CHECK(crawler._schedules.at("3")._changes == 0);
+    removeTestSite(data);
+}
+
+// A page that keeps failing neither fails the cycle nor holds back the rest of the catalog.
+void testMissingPage()
+{
+    const auto data = startTestSite(3);
+    std::remove(pagePath(replay_dir, data[0]._path).data());
+
+    TestCrawler crawler;
+    crawler.refresh(1);
+    CHECK(crawler._known.empty());
+    CHECK(crawler._schedules.at("1")._last_fetch != 0);
+    CHECK(readTestFile("tvseries.xml").empty());
+
+    // the failed series waits behind the ones never tried
+    crawler.refresh(1);
+    CHECK(crawler._known.size() == 1 && crawler._known.count("2") == 1);
+    crawler.refresh(1);
+    CHECK(crawler._known.size() == 2 && crawler._known.count("3") == 1);
+    CHECK(readTestFile("tvseries.xml").empty());
+
+    // every other series has details and the failed one was tried again: published without it
+    crawler.refresh(1);
+    auto xml = readTestFile("tvseries.xml");
+    CHECK(xml.find("Series 2") != std::string::npos && xml.find("Series 3") != std::string::npos);
+    CHECK(xml.find("Series 1") == std::string::npos);
+    CHECK(loadSerials("serials.state").size() == 2);
+
+    writeTestDetails(data[0]);
+    crawler.refresh(1);
+    xml = readTestFile("tvseries.xml");
+    CHECK(xml.find("Series 1") != std::string::npos);
+    removeTestSite(data);
+}
+
+// A cycle with nothing new, run from the state files like cron does, leaves the outputs alone.
+void testQuietCycle()
+{
+    const auto data = startTestSite(2);
+    CHECK(TestCrawler().refresh().size() == 2);
+
+    std::ofstream("tvseries.xml", std::ios::binary) << "untouched";
+    CHECK(TestCrawler().refresh().empty());
+    CHECK(readTestFile("tvseries.xml") == "untouched");
+
+    // a missing output is written again
+    std::remove("tvseries.xml");
+    CHECK(TestCrawler().refresh().size() == 2);
+    CHECK(readTestFile("tvseries.xml").find("Series 2") != std::string::npos);
+    removeTestSite(data);
+}
+
+int main()
+{
+    Logger::instance().setLevel(Level::Error);
+
+    testTokenize();
+    testStateKeys();
+    testStateFiles();
+    testSinkEscaping();
+    testMakeSinks();
+    testTitleIndex();
+    testOriginEjection();
+    testOriginRetry();
+
+    replay_dir = ".";
+    testRefreshInterval();
+    testBrokenListing();
+    testChangeFeed();
+    testBudget();
+    testRenamedSeries();
+    testMissingPage();
+    testQuietCycle();
+
+    Logger::instance().flush();
+    if (failures != 0)
+    {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+    return 0;
+}
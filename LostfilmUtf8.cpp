@@ -9,17 +9,35 @@
 #include <set>
 #include <functional>
 #include <codecvt>
-
-#include <io.h>                           // _O_U8TEXT
-#include <fcntl.h>                        // _setmode
+#include <sstream>
+#include <stdexcept>
 
 #include <boost/asio.hpp>
 
 #ifdef _MSC_VER
-  std::locale locR("rus_rus.1251");       // ukr_ukr.1251
+  #include <windows.h>                    // SetConsoleOutputCP
+#endif // _MSC_VER
+
+#include "Logger.h"
+
+// Same fallback as russianLocale() in Lostfilm.cpp; this tool keeps its own trim, so it does not
+// pull that translation unit in.
+std::locale russianLocaleUtf8()
+{
+#ifdef _MSC_VER
+    return std::locale("rus_rus.1251");       // ukr_ukr.1251
 #else
-  std::locale locR("ru_RU");              // uk_UA
-#endif // !_MSC_VER
+    for (const char* name : { "ru_RU.CP1251", "ru_RU" })    // uk_UA
+    {
+        try { return std::locale(name); }
+        catch (const std::runtime_error&) {}
+    }
+    logWarning("no ru_RU locale is installed, falling back to the classic one");
+    return std::locale::classic();
+#endif  // !_MSC_VER
+}
+
+std::locale locR = russianLocaleUtf8();
 
 
 
@@ -40,11 +58,11 @@ std::stringstream download(Str1 host, Str2 pathWithQuery)
 {
     boost::asio::ip::tcp::iostream ios;
     ios.imbue(locR);
-    ios.expires_from_now(boost::posix_time::seconds(60));
+    ios.expires_after(std::chrono::seconds(60));
     ios.connect(host, "http");
     if (!ios)
     {
-        throw std::exception("Connection error!");
+        throw std::runtime_error("Connection error!");
     }
 
     ios << "GET ";
@@ -81,7 +99,7 @@ struct Row
     std::string _status;
 
     template<typename Str>
-    Row::Row(Str path, Str locName, Str engName, Str country, Str releaseYear, Str genre, Str seasonsAmount, Str status)
+    Row(Str path, Str locName, Str engName, Str country, Str releaseYear, Str genre, Str seasonsAmount, Str status)
         : _path(path)
         , _locName(locName)
         , _engName(engName)
@@ -92,16 +110,16 @@ struct Row
         , _status(status)
     {}
 
-    friend std::wostream& operator<<(std::wostream& out, const Row& r)
+    friend std::ostream& operator<<(std::ostream& out, const Row& r)
     {
-        out << "path: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._path)
-            << "\nloc: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._locName)
-            << "\neng: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._engName)
-            << "\ncountry: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._country)
-            << "\nyear: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._releaseYear)
-            << "\ngenre: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._genre)
-            << "\namount: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._seasonsAmount)
-            << "\nstatus: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(r._status)
+        out << "path: " << r._path
+            << "\nloc: " << r._locName
+            << "\neng: " << r._engName
+            << "\ncountry: " << r._country
+            << "\nyear: " << r._releaseYear
+            << "\ngenre: " << r._genre
+            << "\namount: " << r._seasonsAmount
+            << "\nstatus: " << r._status
             << "\n";
         return out;
     }
@@ -135,31 +153,24 @@ std::vector<std::string> tokenizeString(const std::string& str, bool toUpperFirs
 {
     std::vector<std::string> vs = std::vector<std::string>();
 
-    char* cstr = new char[str.size() + 1];
-    strcpy_s(cstr, str.size() + 1, str.data());
-    char* token = nullptr;
-    char* next_token = nullptr;
-    char seps[] = ",/.";
-    token = strtok_s(cstr, seps, &next_token);
-    while (token != nullptr)
+    const char seps[] = ",/.";
+    std::string::size_type begin = str.find_first_not_of(seps);
+    while (begin != std::string::npos)
     {
-        if (token != nullptr)
+        const std::string::size_type end = str.find_first_of(seps, begin);
+        std::string strToken = str.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+        if (toUpperFirstLetter)
         {
-            std::string strToken = token;
-            if (toUpperFirstLetter)
-            {
-                std::wstring wstrTmp = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(trim(strToken));
-                std::use_facet<std::ctype<wchar_t>>(locR).toupper(&wstrTmp[0], &wstrTmp[0] + 1);
-                vs.push_back(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(wstrTmp));
-            }
-            else
-            {
-                vs.push_back(trim(strToken));
-            }
-            token = strtok_s(nullptr, seps, &next_token);
+            std::wstring wstrTmp = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(trim(strToken));
+            std::use_facet<std::ctype<wchar_t>>(locR).toupper(&wstrTmp[0], &wstrTmp[0] + 1);
+            vs.push_back(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(wstrTmp));
         }
+        else
+        {
+            vs.push_back(trim(strToken));
+        }
+        begin = end == std::string::npos ? end : str.find_first_not_of(seps, end);
     }
-    delete[] cstr;
 
     return vs;
 }
@@ -250,9 +261,17 @@ void makeXmlGenresAndCountries(const GenresAndCountries& gac)
 
 
 
-int main()
+int main(int argc, char* argv[])
 {
-    _setmode(_fileno(stdout), _O_U8TEXT);
+#ifdef _MSC_VER
+    SetConsoleOutputCP(CP_UTF8);          // the rows are written as UTF-8 bytes
+#endif // _MSC_VER
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-q" || arg == "--quiet") { Logger::instance().setLevel(Level::Warning); }
+        else if (arg == "-v" || arg == "--verbose") { Logger::instance().setLevel(Level::Debug); }
+    }
     try
     {
         std::stringstream streamFullList = download("www.lostfilm.tv", "/serials.php");
@@ -301,14 +320,11 @@ int main()
                 }
             }
         }
-        std::wcout << "Received " << listTupleBegin.size() << " URLs" << std::endl;
+        logInfo("Received ", listTupleBegin.size(), " URLs");
 
-        for (auto l : listTupleBegin)
+        for (const auto& l : listTupleBegin)
         {
-            std::wcout << "url: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(std::get<0>(l))
-                << ", loc: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(std::get<1>(l))
-                << ", eng: " << std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(std::get<2>(l))
-                << std::endl;
+            logDebug("url: ", std::get<0>(l), ", loc: ", std::get<1>(l), ", eng: ", std::get<2>(l));
         }
 
         for (auto tuple : listTupleBegin)
@@ -353,13 +369,12 @@ int main()
                 continue;
             }
             static int counter = 0;
-            std::wstring strTmp = std::wstring_convert<std::codecvt_utf8<wchar_t>>().from_bytes(std::get<1>(tuple));
-            std::wcout << "Received the information about <" << ++counter << "> " << strTmp << std::endl;
+            logInfo("Received the information about <", ++counter, "> ", std::get<1>(tuple));
         }
 
-        for (auto r : listRowAll)
+        for (const auto& r : listRowAll)
         {
-            std::wcout << r << std::endl;
+            logDebug(r);
         }
 
         GenresAndCountries gac;
@@ -368,10 +383,11 @@ int main()
     }
     catch (const std::exception e)
     {
-        std::cout << e.what() << std::endl;
+        logError(e.what());
     }
 
-    std::wcout << "\n\nPush 'Enter' to exit...";
-    std::wcin.get();
+    Logger::instance().flush();
+    std::cout << "\n\nPush 'Enter' to exit...";
+    std::cin.get();
     return 0;
 }
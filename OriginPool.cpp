@@ -0,0 +1,104 @@
+#include "OriginPool.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+
+
+void OriginPool::add(const std::string& origin)
+{
+    Origin added;
+    const auto colon = origin.rfind(':');
+    added._address = origin.substr(0, colon);
+    added._port = colon == std::string::npos ? "http" : origin.substr(colon + 1);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _origins.push_back(added);
+}
+
+bool OriginPool::empty() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _origins.empty();
+}
+
+std::size_t OriginPool::size() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _origins.size();
+}
+
+// Least outstanding requests among the untried origins in rotation, then the lower average
+// latency. Failing that, an untried origin out of rotation; failing that, any origin.
+std::size_t OriginPool::acquire(const std::vector<std::size_t>& tried)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_origins.empty()) { throw std::runtime_error("No origins to fetch from"); }
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto is_better = [](const Origin& a, const Origin& b) {
+        return a._outstanding != b._outstanding ? a._outstanding < b._outstanding : a._latency < b._latency;
+    };
+
+    const auto is_tried = [&tried](std::size_t index) {
+        return std::find(tried.begin(), tried.end(), index) != tried.end();
+    };
+
+    std::size_t best = _origins.size();
+    for (const int pass : { 0, 1, 2 })            // healthy and untried, untried, any
+    {
+        for (std::size_t i = 0; i < _origins.size(); ++i)
+        {
+            const std::size_t index = (_next + i) % _origins.size();
+            const Origin& origin = _origins[index];
+            if (pass < 2 && is_tried(index)) { continue; }
+            if (pass == 0 && origin._ejected_until > now) { continue; }
+            if (best == _origins.size() || is_better(origin, _origins[best])) { best = index; }
+        }
+        if (best != _origins.size()) { break; }
+    }
+
+    _next = (best + 1) % _origins.size();
+    ++_origins[best]._outstanding;
+    ++_origins[best]._requests;
+    return best;
+}
+
+void OriginPool::release(std::size_t index, bool is_ok, std::chrono::milliseconds latency)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    Origin& origin = _origins[index];
+    --origin._outstanding;
+
+    // a quick error page says nothing about how fast the origin serves, so only successes count
+    origin._failures = is_ok ? 0 : origin._failures + 1;
+    if (is_ok)
+    {
+        origin._latency = origin._latency == 0 ? latency.count() : 0.8 * origin._latency + 0.2 * latency.count();
+    }
+
+    if (origin._failures >= _max_failures || origin._latency > _latency_limit.count())
+    {
+        origin._ejected_until = std::chrono::steady_clock::now() + _cooldown;
+        origin._failures = 0;
+        origin._latency = 0;                      // judged afresh when it is back
+    }
+}
+
+std::string OriginPool::address(std::size_t origin) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _origins[origin]._address;
+}
+
+std::string OriginPool::port(std::size_t origin) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _origins[origin]._port;
+}
+
+std::size_t OriginPool::requests(std::size_t origin) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _origins[origin]._requests;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+
+// Mirrors or caching proxies that serve the same site. acquire() hands out the origin with the
+// fewest requests in flight; an origin that fails `max_failures` times in a row or whose average
+// latency of successful requests exceeds `latency_limit` is left out of rotation for `cooldown`.
+class OriginPool {
+public:
+    explicit OriginPool(std::chrono::milliseconds latency_limit = std::chrono::milliseconds(2000),
+        unsigned max_failures = 3,
+        std::chrono::seconds cooldown = std::chrono::seconds(30))
+        : _latency_limit(latency_limit)
+        , _max_failures(max_failures)
+        , _cooldown(cooldown)
+    {}
+
+    // "host" or "host:port"; the port defaults to http
+    void add(const std::string& origin);
+
+    bool empty() const;
+
+    std::size_t size() const;
+
+    // `tried`: origins this request has already failed on, skipped while any other is left
+    std::size_t acquire(const std::vector<std::size_t>& tried = {});
+
+    void release(std::size_t origin, bool is_ok, std::chrono::milliseconds latency);
+
+    std::string address(std::size_t origin) const;
+
+    std::string port(std::size_t origin) const;
+
+    std::size_t requests(std::size_t origin) const;
+
+private:
+    struct Origin {
+        std::string _address;
+        std::string _port;
+        std::size_t _outstanding = 0;
+        std::size_t _requests = 0;
+        unsigned _failures = 0;                   // in a row
+        double _latency = 0;                      // moving average of successful requests, ms
+        std::chrono::steady_clock::time_point _ejected_until;
+    };
+
+    std::chrono::milliseconds _latency_limit;
+    unsigned _max_failures;
+    std::chrono::seconds _cooldown;
+
+    mutable std::mutex _mutex;
+    std::vector<Origin> _origins;
+    std::size_t _next = 0;                        // rotates ties
+};
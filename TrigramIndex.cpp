@@ -0,0 +1,324 @@
+#include "TrigramIndex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+
+
+std::string foldTitle(const std::string& str)
+{
+    std::string folded;
+    folded.reserve(str.size());
+    for (const auto ch : str)
+    {
+        auto c = static_cast<unsigned char>(ch);
+        if (c >= 'A' && c <= 'Z') { c += 'a' - 'A'; }
+        else if (c >= 0xC0 && c <= 0xDF) { c += 0x20; }           // cyrillic capitals
+        else if (c == 0xA8 || c == 0xB8) { c = 0xE5; }            // yo -> ye
+
+        const bool is_alnum = (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0xE0;
+        if (is_alnum) { folded += static_cast<char>(c); }
+        else if (!folded.empty() && folded.back() != ' ') { folded += ' '; }
+    }
+    if (!folded.empty() && folded.back() == ' ') { folded.pop_back(); }
+    return folded;
+}
+
+std::vector<std::uint32_t> trigrams(const std::string& folded)
+{
+    std::vector<std::uint32_t> grams;
+
+    const auto add_word = [&grams](const std::string& word) {
+        const std::string padded = "  " + word + " ";
+        for (std::size_t i = 0; i + 2 < padded.size(); ++i)
+        {
+            grams.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i])) << 16
+                | static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8
+                | static_cast<std::uint32_t>(static_cast<unsigned char>(padded[i + 2])));
+        }
+    };
+
+    std::size_t begin = 0;
+    while (begin < folded.size())
+    {
+        std::size_t end = folded.find(' ', begin);
+        if (end == std::string::npos) { end = folded.size(); }
+        add_word(folded.substr(begin, end - begin));
+        begin = end + 1;
+    }
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+bool isUtf8(const std::string& str)
+{
+    bool has_multibyte = false;
+    for (std::size_t i = 0; i < str.size(); )
+    {
+        const auto c = static_cast<unsigned char>(str[i]);
+        std::size_t length = 1;
+        if (c >= 0xF0 && c <= 0xF4) { length = 4; }
+        else if (c >= 0xE0) { length = 3; }
+        else if (c >= 0xC2 && c <= 0xDF) { length = 2; }
+        else if (c >= 0x80) { return false; }
+
+        if (i + length > str.size()) { return false; }
+        for (std::size_t j = 1; j < length; ++j)
+        {
+            if ((static_cast<unsigned char>(str[i + j]) & 0xC0) != 0x80) { return false; }
+        }
+        has_multibyte = has_multibyte || length > 1;
+        i += length;
+    }
+    return has_multibyte;
+}
+
+std::string utf8ToCp1251(const std::string& str)
+{
+    static const std::unordered_map<std::uint32_t, char> specials = {
+        { 0x0401, '\xA8' }, { 0x0451, '\xB8' },                   // Yo, yo
+        { 0x00A0, '\xA0' }, { 0x00AB, '\xAB' }, { 0x00BB, '\xBB' },
+        { 0x2013, '\x96' }, { 0x2014, '\x97' }, { 0x2026, '\x85' },
+        { 0x2116, '\xB9' }
+    };
+
+    std::string out;
+    out.reserve(str.size());
+    for (std::size_t i = 0; i < str.size(); )
+    {
+        const auto c = static_cast<unsigned char>(str[i]);
+        std::uint32_t code = c;
+        std::size_t length = 1;
+        if (c >= 0xF0) { code = c & 0x07; length = 4; }
+        else if (c >= 0xE0) { code = c & 0x0F; length = 3; }
+        else if (c >= 0xC0) { code = c & 0x1F; length = 2; }
+        for (std::size_t j = 1; j < length && i + j < str.size(); ++j)
+        {
+            code = (code << 6) | (static_cast<unsigned char>(str[i + j]) & 0x3F);
+        }
+        i += length;
+
+        if (code < 0x80) { out += static_cast<char>(code); }
+        else if (code >= 0x0410 && code <= 0x044F) { out += static_cast<char>(0xC0 + (code - 0x0410)); }
+        else
+        {
+            const auto it = specials.find(code);
+            out += it != specials.end() ? it->second : '?';
+        }
+    }
+    return out;
+}
+
+
+
+void TrigramIndex::add(std::string path, std::string loc_name, std::string orig_name)
+{
+    const auto title = static_cast<std::uint32_t>(_titles.size());
+    _titles.push_back({ std::move(path), std::move(loc_name), std::move(orig_name) });
+    indexName(title * 2, _titles.back()._loc_name);
+    indexName(title * 2 + 1, _titles.back()._orig_name);
+}
+
+void TrigramIndex::indexName(std::uint32_t doc, const std::string& name)
+{
+    const auto grams = trigrams(foldTitle(name));
+    _doc_sizes.push_back(static_cast<std::uint32_t>(grams.size()));
+    for (const auto gram : grams)
+    {
+        _postings[gram].push_back(doc);
+    }
+}
+
+// Any name with a similarity of at least min_score shares at least m = ceil(min_score * q) of
+// the q query trigrams, so it is in one of the q - m + 1 rarest posting lists. Only those lists
+// are scanned for candidates; the longer ones are probed for the candidates alone.
+std::vector<TrigramIndex::Match> TrigramIndex::search(const std::string& query, std::size_t limit, double min_score) const
+{
+    static const std::vector<std::uint32_t> empty;
+
+    const auto grams = trigrams(foldTitle(isUtf8(query) ? utf8ToCp1251(query) : query));
+    if (grams.empty()) { return {}; }
+
+    std::vector<const std::vector<std::uint32_t>*> lists;
+    for (const auto gram : grams)
+    {
+        const auto it = _postings.find(gram);
+        lists.push_back(it != _postings.end() ? &it->second : &empty);
+    }
+    std::sort(lists.begin(), lists.end(),
+        [](const std::vector<std::uint32_t>* a, const std::vector<std::uint32_t>* b) { return a->size() < b->size(); });
+
+    const std::size_t required = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(min_score * grams.size())));
+    const std::size_t prefix = grams.size() - required + 1;
+
+    std::vector<std::uint16_t> common(_doc_sizes.size(), 0);
+    std::vector<std::uint32_t> touched;
+    for (std::size_t i = 0; i < prefix; ++i)
+    {
+        for (const auto doc : *lists[i])
+        {
+            if (common[doc]++ == 0) { touched.push_back(doc); }
+        }
+    }
+    for (std::size_t i = prefix; i < lists.size(); ++i)
+    {
+        const auto& docs = *lists[i];
+        if (touched.size() * 16 < docs.size())
+        {
+            for (const auto doc : touched)
+            {
+                if (std::binary_search(docs.begin(), docs.end(), doc)) { ++common[doc]; }
+            }
+        }
+        else
+        {
+            for (const auto doc : docs)
+            {
+                if (common[doc] != 0) { ++common[doc]; }
+            }
+        }
+    }
+
+    std::vector<Match> candidates;
+    candidates.reserve(touched.size());
+    for (const auto doc : touched)
+    {
+        const double shared = common[doc];
+        const double score = shared / (grams.size() + _doc_sizes[doc] - shared);
+        if (score >= min_score) { candidates.push_back({ doc / 2, score }); }
+    }
+
+    const auto better = [](const Match& a, const Match& b) {
+        return a._score != b._score ? a._score > b._score : a._title < b._title;
+    };
+
+    // both names of a title may be among the candidates, so 2 * limit covers `limit` titles
+    const std::size_t keep = std::min(candidates.size(), 2 * limit);
+    std::partial_sort(candidates.begin(), candidates.begin() + keep, candidates.end(), better);
+    candidates.resize(keep);
+
+    std::vector<Match> matches;
+    for (const auto& e : candidates)
+    {
+        if (matches.size() == limit) { break; }
+        const auto same = [&e](const Match& m) { return m._title == e._title; };
+        if (std::none_of(matches.begin(), matches.end(), same)) { matches.push_back(e); }
+    }
+    return matches;
+}
+
+
+
+namespace {
+
+const char index_magic[] = "LFTI0001";
+
+void writeU32(std::ostream& out, std::uint32_t value)
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void writeString(std::ostream& out, const std::string& str)
+{
+    writeU32(out, static_cast<std::uint32_t>(str.size()));
+    out.write(str.data(), str.size());
+}
+
+std::uint32_t readU32(std::istream& in)
+{
+    std::uint32_t value = 0;
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+}
+
+// Bytes between the read position and `end`; every length read from the file is checked against
+// it before anything is allocated, so a truncated or foreign file fails instead of exhausting memory.
+std::uint64_t remaining(std::istream& in, std::streamoff end)
+{
+    const std::streamoff pos = in.tellg();
+    return in && pos >= 0 && pos <= end ? static_cast<std::uint64_t>(end - pos) : 0;
+}
+
+std::string readString(std::istream& in, std::streamoff end)
+{
+    const std::uint32_t size = readU32(in);
+    if (size > remaining(in, end))
+    {
+        in.setstate(std::ios::failbit);
+        return {};
+    }
+    std::string str(size, '\0');
+    in.read(&str[0], str.size());
+    return str;
+}
+
+}  // namespace
+
+void TrigramIndex::save(std::ostream& out) const
+{
+    out.write(index_magic, sizeof(index_magic) - 1);
+    writeU32(out, static_cast<std::uint32_t>(_titles.size()));
+    for (const auto& e : _titles)
+    {
+        writeString(out, e._path);
+        writeString(out, e._loc_name);
+        writeString(out, e._orig_name);
+    }
+    for (const auto e : _doc_sizes)
+    {
+        writeU32(out, e);
+    }
+    writeU32(out, static_cast<std::uint32_t>(_postings.size()));
+    for (const auto& e : _postings)
+    {
+        writeU32(out, e.first);
+        writeU32(out, static_cast<std::uint32_t>(e.second.size()));
+        out.write(reinterpret_cast<const char*>(e.second.data()), e.second.size() * sizeof(std::uint32_t));
+    }
+}
+
+bool TrigramIndex::load(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    const std::streamoff end = in.tellg();
+    in.seekg(0);
+    std::string magic(sizeof(index_magic) - 1, '\0');
+    if (!in.read(&magic[0], magic.size()) || magic != index_magic) { return false; }
+
+    TrigramIndex loaded;
+    const std::uint32_t titles = readU32(in);
+    if (titles * std::uint64_t(5 * sizeof(std::uint32_t)) > remaining(in, end)) { return false; }  // 3 lengths, 2 doc sizes
+    loaded._titles.resize(titles);
+    for (auto& e : loaded._titles)
+    {
+        e._path = readString(in, end);
+        e._loc_name = readString(in, end);
+        e._orig_name = readString(in, end);
+    }
+    loaded._doc_sizes.resize(loaded._titles.size() * 2);
+    for (auto& e : loaded._doc_sizes)
+    {
+        e = readU32(in);
+    }
+    const std::uint32_t keys = readU32(in);
+    if (keys * std::uint64_t(2 * sizeof(std::uint32_t)) > remaining(in, end)) { return false; }
+    for (std::uint32_t i = 0; in && i != keys; ++i)
+    {
+        const auto gram = readU32(in);
+        const std::uint32_t size = readU32(in);
+        if (size * std::uint64_t(sizeof(std::uint32_t)) > remaining(in, end)) { return false; }
+
+        auto& docs = loaded._postings[gram];
+        docs.resize(size);
+        in.read(reinterpret_cast<char*>(docs.data()), docs.size() * sizeof(std::uint32_t));
+        const auto is_unknown = [&loaded](std::uint32_t doc) { return doc >= loaded._doc_sizes.size(); };
+        if (std::any_of(docs.begin(), docs.end(), is_unknown)) { return false; }
+    }
+    if (!in) { return false; }
+
+    *this = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+
+struct IndexedTitle {
+    std::string _path;
+    std::string _loc_name;
+    std::string _orig_name;
+};
+
+// Inverted trigram index over the localized and the original name of every title, for fuzzy
+// lookup with typos in either script. Names are windows-1251 like the rest of the crawler;
+// a UTF-8 query is converted first. Matching is case-insensitive and treats \xB8 (yo) as \xE5 (ye).
+class TrigramIndex {
+public:
+    struct Match {
+        std::size_t _title;
+        double _score;                        // Jaccard similarity of the trigram sets, 0..1
+    };
+
+    void add(std::string path, std::string loc_name, std::string orig_name);
+
+    // Best `limit` titles scoring at least `min_score`, most similar first.
+    std::vector<Match> search(const std::string& query, std::size_t limit = 10, double min_score = 0.2) const;
+
+    const IndexedTitle& title(std::size_t index) const { return _titles[index]; }
+
+    std::size_t size() const { return _titles.size(); }
+
+    // Binary; the stream has to be opened in binary mode.
+    void save(std::ostream& out) const;
+
+    // Leaves the index as it is and returns false when the file is missing or malformed.
+    bool load(const std::string& filename);
+
+private:
+    void indexName(std::uint32_t doc, const std::string& name);
+
+    std::vector<IndexedTitle> _titles;
+    std::vector<std::uint32_t> _doc_sizes;    // distinct trigrams of a name; doc = title * 2 + (0 loc, 1 orig)
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> _postings;
+};
+
+// Lower case, yo -> ye, anything but letters and digits -> single spaces. windows-1251 in and out.
+std::string foldTitle(const std::string& str);
+
+// Sorted distinct trigrams of a folded string, every word padded as "  word ".
+std::vector<std::uint32_t> trigrams(const std::string& folded);
+
+bool isUtf8(const std::string& str);
+
+std::string utf8ToCp1251(const std::string& str);
@@ -0,0 +1,144 @@
+#include "Lostfilm.h"
+
+
+
+// A whole number of at least `minimum` for `option`; anything else is an error rather than a default.
+unsigned long parseNumber(const std::string& option, const std::string& value, unsigned long minimum = 0)
+{
+    std::size_t end = 0;
+    unsigned long number = 0;
+    if (!value.empty() && value[0] >= '0' && value[0] <= '9')
+    {
+        try { number = std::stoul(value, &end); }
+        catch (const std::out_of_range&) { end = 0; }
+    }
+    if (end == 0 || end != value.size() || number < minimum)
+    {
+        throw std::runtime_error("Bad value for " + option + ": " + value);
+    }
+    return number;
+}
+
+int main(int argc, char* argv[])
+{
+    std::locale::global(locr);
+
+    std::string host = "www.lostfilm.tv";
+    std::string path = "/serials.php";
+
+    bool is_daemon = false;
+    std::chrono::seconds interval(3600);
+    std::size_t budget = 0;
+    std::string query;
+    std::string formats = "xml";
+    std::vector<std::unique_ptr<Sink>> sinks;
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string arg = argv[i];
+            const auto value = [&]() -> std::string {
+                if (i + 1 == argc) { throw std::runtime_error(arg + " needs a value"); }
+                return argv[++i];
+            };
+            if (arg == "--daemon") { is_daemon = true; }
+            else if (arg == "--interval") { interval = std::chrono::seconds(parseNumber(arg, value(), 1)); }
+            else if (arg == "--budget") { budget = parseNumber(arg, value()); }
+            else if (arg == "--record") { record_dir = value(); }
+            else if (arg == "--replay") { replay_dir = value(); }
+            else if (arg == "--search") { query = value(); }
+            else if (arg == "--formats") { formats = value(); }
+            else if (arg == "--origin") { origins.add(value()); }
+            else if (arg == "--connections") { connections = parseNumber(arg, value(), 1); }
+            else if (arg == "-q" || arg == "--quiet") { Logger::instance().setLevel(Level::Warning); }
+            else if (arg == "-v" || arg == "--verbose") { Logger::instance().setLevel(Level::Debug); }
+            else { throw std::runtime_error("Unknown option " + arg); }
+        }
+
+        sinks = makeSinks(formats);
+    }
+    catch (const std::exception& e)
+    {
+        logError(e.what());
+        Logger::instance().flush();
+        return 1;
+    }
+
+    if (!query.empty())
+    {
+        TrigramIndex index;
+        if (!index.load("tvseries.idx"))
+        {
+            index = indexXmlFullData("tvseries.xml");
+        }
+        Logger::instance().flush();
+
+        // the titles are windows-1251; a UTF-8 query, or any terminal off Windows, gets UTF-8 back
+#ifdef _MSC_VER
+        const bool is_to_utf8 = isUtf8(query);
+#else
+        const bool is_to_utf8 = true;
+#endif  // _MSC_VER
+
+        // the results are the output of --search, not log messages, so -q does not hide them
+        for (const auto& e : index.search(query))
+        {
+            const auto& title = index.title(e._title);
+            std::cout << e._score
+                << "\t" << converter(title._loc_name, is_to_utf8)
+                << " (" << converter(title._orig_name, is_to_utf8) << ")"
+                << "\t" << title._path << "\n";
+        }
+        return 0;
+    }
+
+    if (is_daemon && !record_dir.empty())
+    {
+        logError("--record makes a full crawl of its own and cannot be combined with --daemon");
+        Logger::instance().flush();
+        return 1;
+    }
+
+    if (is_daemon)
+    {
+        runDaemon(host, path, interval, budget, sinks);
+        return 0;
+    }
+
+    try
+    {
+        std::vector<Serial> serials;
+        if (!record_dir.empty())
+        {
+            // every page, whatever the state files say, so the corpus can be replayed in full
+            makeDirectory(record_dir);
+            serials = downloadSerials(host, downloadInformation(host, path));
+            writeSinks(makeCatalog(serials), sinks);
+            const auto index = makeTitleIndex(serials);
+            writeAtomically("tvseries.idx", [&index](std::ostream& fout) { index.save(fout); }, true);
+        }
+        else
+        {
+            // one shot, e.g. from cron: the same state files as the daemon, so only what is due is fetched
+            auto hashes = loadListingState("listing.state");
+            auto schedules = loadSchedules("schedule.state");
+            auto known = loadSerials("serials.state");
+            bool is_stale = loadStale("outputs.state", sinks);
+            serials = refreshListing(host, path, hashes, schedules, known, budget, sinks, is_stale);
+        }
+
+        if (Logger::instance().enabled(Level::Debug))
+        {
+            for (const auto& e : serials) { logDebug(e); }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        logError(e.what());
+        Logger::instance().flush();
+        return 1;
+    }
+
+    Logger::instance().flush();
+    return 0;
+}